@@ -14,8 +14,26 @@ function start() {
         return
     fi
 
+    # Video level selected by the legoirc-bwmgr
+    if [ -n "$CAM_LEVEL_FILE" ] && [ -e $CAM_LEVEL_FILE ]; then
+        source $CAM_LEVEL_FILE
+    fi
+
+    if [ -n "$CAM_SOURCE" ]; then
+        # File based source for testing (re-encoded to the current level)
+        SOURCE="ffmpeg -loglevel quiet -re -stream_loop -1 -i $CAM_SOURCE -an -c:v libx264 -tune zerolatency ${CAM_WIDTH:+-vf scale=${CAM_WIDTH}:${CAM_HEIGHT}} ${CAM_FPS:+-r $CAM_FPS} ${CAM_BITRATE:+-b:v $CAM_BITRATE} -f h264 -"
+    else
+        # The level options override the ones from the CAM_RASPIVID_OPTIONS
+        SOURCE="/opt/vc/bin/raspivid -o - $CAM_RASPIVID_OPTIONS ${CAM_WIDTH:+-w $CAM_WIDTH -h $CAM_HEIGHT} ${CAM_FPS:+-fps $CAM_FPS} ${CAM_BITRATE:+-b $CAM_BITRATE}"
+    fi
+
+    # Publish the latest frame for the local readers
+    if [ -n "$CAM_FRAMEBUF" ]; then
+        SOURCE="$SOURCE | /usr/bin/legoirc-framebuf -f $CAM_FRAMEBUF"
+    fi
+
     # Start the streaming on background
-    /opt/vc/bin/raspivid -o - $CAM_RASPIVID_OPTIONS | /usr/bin/cvlc -vvv stream:///dev/stdin --sout "#standard{access=http,mux=ts,dst=:${CAM_PORT}}" :demux=h264 1>/dev/null 2>&1 &
+    eval $SOURCE | /usr/bin/cvlc -vvv stream:///dev/stdin --sout "#standard{access=http,mux=ts,dst=:${CAM_PORT}}" :demux=h264 1>/dev/null 2>&1 &
     echo $! > $PIDFILE
 }
 
@@ -40,6 +58,11 @@ case $PARAM in
         stop
         shift
         ;;
+    'restart')
+        stop
+        start
+        shift
+        ;;
     *)
         echo "ERROR: Unknown action: $PARAM"
         shift
@@ -0,0 +1,127 @@
+// Simulated GPIO backend replacing the bcm2835 library (compile with
+// -DGPIO_SIM). Every change of the pin level is written into the trace file
+// defined by the LEGOIRC_GPIO_TRACE environment variable as a line with the
+// CLOCK_MONOTONIC time in microseconds, the pin number and the level:
+//
+//   1234567890 24 1
+//
+// The trace can be decoded and checked by the legoirc-irdecode.
+
+#ifndef GPIO_SIM_H
+#define GPIO_SIM_H
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define HIGH 1
+#define LOW 0
+
+#define BCM2835_GPIO_FSEL_INPT 0
+#define BCM2835_GPIO_FSEL_OUTP 1
+
+// GPIO24 on the J8 header
+#define RPI_BPLUS_GPIO_J8_18 24
+
+// Number of the simulated pins
+#define GPIO_SIM_PINS 54
+
+// Flush the trace only in pauses longer than this (in microseconds)
+#define GPIO_SIM_FLUSH_WAIT 2000
+
+// Like the bcm2835 library, sleep only in the long pauses and busy wait the
+// rest (in microseconds)
+#define GPIO_SIM_SLEEP_MIN 450
+#define GPIO_SIM_BUSY_WAIT 200
+
+
+static FILE *gpio_sim_trace = NULL;
+static int gpio_sim_level[GPIO_SIM_PINS];
+
+
+static unsigned long long gpio_sim_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void gpio_sim_flush() {
+    if (gpio_sim_trace != NULL)
+        fflush(gpio_sim_trace);
+}
+
+
+// Don't lose the end of the trace when the server is killed (not async-signal
+// safe but good enough for the simulation)
+static void gpio_sim_terminate(int sig) {
+    gpio_sim_flush();
+    _exit(EXIT_SUCCESS);
+}
+
+
+static int bcm2835_init() {
+    char *path = getenv("LEGOIRC_GPIO_TRACE");
+
+    if (path != NULL && (gpio_sim_trace = fopen(path, "a")) == NULL) {
+        perror("ERROR opening GPIO trace");
+        return 0;
+    }
+
+    atexit(gpio_sim_flush);
+    signal(SIGTERM, gpio_sim_terminate);
+    signal(SIGINT, gpio_sim_terminate);
+
+    return 1;
+}
+
+
+static int bcm2835_close() {
+    if (gpio_sim_trace != NULL)
+        fclose(gpio_sim_trace);
+
+    return 1;
+}
+
+
+static void bcm2835_gpio_fsel(unsigned char pin, unsigned char mode) {
+}
+
+
+static void bcm2835_gpio_write(unsigned char pin, unsigned char on) {
+    if (pin >= GPIO_SIM_PINS || gpio_sim_level[pin] == on)
+        return;
+
+    gpio_sim_level[pin] = on;
+
+    if (gpio_sim_trace != NULL)
+        fprintf(gpio_sim_trace, "%llu %d %d\n", gpio_sim_now(), pin, on);
+}
+
+
+static void bcm2835_delayMicroseconds(unsigned long long micros) {
+    unsigned long long deadline = gpio_sim_now() + micros;
+    struct timespec ts;
+
+    // Write the trace out while the pin is idle
+    if (gpio_sim_trace != NULL && micros >= GPIO_SIM_FLUSH_WAIT)
+        fflush(gpio_sim_trace);
+
+    if (micros > GPIO_SIM_SLEEP_MIN) {
+        micros -= GPIO_SIM_BUSY_WAIT;
+
+        ts.tv_sec = micros / 1000000;
+        ts.tv_nsec = (micros % 1000000) * 1000;
+
+        nanosleep(&ts, NULL);
+    }
+
+    while (gpio_sim_now() < deadline);
+}
+
+#endif
@@ -0,0 +1,382 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+
+// Max number of the video levels
+#define MAX_LEVELS 8
+
+// Size of the netlink receive buffer
+#define BUFSIZE 8192
+
+// TCP state (from the kernel)
+#define STATE_ESTABLISHED 1
+
+
+// Debug variable
+int DEBUG = 0;
+
+// Video level (width, height, frame rate and bitrate)
+struct level {
+    int width;
+    int height;
+    int fps;
+    int bitrate;
+};
+
+// Video levels ordered from the best one (the first one must correspond with
+// the CAM_RASPIVID_OPTIONS)
+struct level LEVELS[MAX_LEVELS] = {
+    {800, 400, 24, 2000000},
+    {640, 320, 15, 1000000},
+    {480, 240, 10, 500000},
+    {320, 160, 5, 200000},
+};
+int LEVELS_NUM = 4;
+
+// Ports of the control and the camera connections
+int CONTROL_PORT = 5001;
+int CAMERA_PORT = 8160;
+
+// Round-trip time of the connections (in milliseconds) and camera send queue
+// (in bytes) which trigger the lower video level
+unsigned int RTT_HIGH = 50;
+unsigned int QUEUE_HIGH = 262144;
+
+// Polling interval (in milliseconds)
+unsigned int INTERVAL = 500;
+
+// Minimal time between lowering and raising the level (in seconds). Every
+// change restarts the camera stream so it must not happen too often.
+int DOWN_HOLD = 5;
+int UP_HOLD = 10;
+
+// File with the selected level read by the vlc-camera-stream.sh
+char *LEVEL_FILE = "/run/vlc-camera-stream.level";
+
+// Command restarting the camera stream
+char *RESTART_CMD = "systemctl restart vlc-camera-stream.service";
+
+// Statistics of the connections
+struct conn_stats {
+    int control_conns;
+    int camera_conns;
+    // Max round-trip time of the control connections with a fresh sample and
+    // of the camera connections (in microseconds)
+    unsigned int control_rtt;
+    unsigned int camera_rtt;
+    // Max send queue of the camera connections (in bytes)
+    unsigned int camera_queue;
+};
+
+
+long long now_ms() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+// Process a single socket of the sock_diag dump
+void add_socket(struct inet_diag_msg *diag, int len, struct conn_stats *stats) {
+    struct rtattr *attr;
+    struct tcp_info *info = NULL;
+    int port = ntohs(diag->id.idiag_sport);
+
+    for (attr = (struct rtattr *) (diag + 1); RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
+        if (attr->rta_type == INET_DIAG_INFO)
+            info = (struct tcp_info *) RTA_DATA(attr);
+    }
+
+    if (port == CONTROL_PORT && info != NULL) {
+        stats->control_conns++;
+
+        // The round-trip time is updated only when the sent data are
+        // acknowledged (the receiver side estimate stays 0 for the short
+        // commands), so it's used only if the server replied recently to the
+        // time requests of the client (sent every 500 ms by the
+        // legoirc-client)
+        if (info->tcpi_last_data_sent <= 2 * INTERVAL && info->tcpi_rtt > stats->control_rtt)
+            stats->control_rtt = info->tcpi_rtt;
+    } else if (port == CAMERA_PORT) {
+        stats->camera_conns++;
+
+        // The camera stream is acknowledged all the time so its round-trip
+        // time follows the queueing delay of the link shared with the control
+        // connections
+        if (info != NULL && info->tcpi_rtt > stats->camera_rtt)
+            stats->camera_rtt = info->tcpi_rtt;
+
+        // Unacknowledged and unsent bytes
+        if (diag->idiag_wqueue > stats->camera_queue)
+            stats->camera_queue = diag->idiag_wqueue;
+    }
+}
+
+
+// Dump the established TCP sockets of the family through the sock_diag
+int get_stats(int sock, int family, struct conn_stats *stats) {
+    struct {
+        struct nlmsghdr nlh;
+        struct inet_diag_req_v2 req;
+    } req;
+    struct sockaddr_nl addr;
+    struct nlmsghdr *nlh;
+    char buf[BUFSIZE];
+    int n;
+
+    bzero((char *) &addr, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+
+    bzero((char *) &req, sizeof(req));
+    req.nlh.nlmsg_len = sizeof(req);
+    req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.req.sdiag_family = family;
+    req.req.sdiag_protocol = IPPROTO_TCP;
+    req.req.idiag_states = 1 << STATE_ESTABLISHED;
+    req.req.idiag_ext = 1 << (INET_DIAG_INFO - 1);
+
+    if (sendto(sock, &req, sizeof(req), 0, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+        return -1;
+
+    while (1) {
+        if ((n = recv(sock, buf, sizeof buf, 0)) == -1)
+            return -1;
+
+        for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n)) {
+            if (nlh->nlmsg_type == NLMSG_DONE)
+                return 0;
+
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                errno = -((struct nlmsgerr *) NLMSG_DATA(nlh))->error;
+                return -1;
+            }
+
+            add_socket((struct inet_diag_msg *) NLMSG_DATA(nlh),
+                nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct inet_diag_msg)), stats);
+        }
+    }
+}
+
+
+// Write the level for the vlc-camera-stream.sh and restart the stream
+void set_level(int level, int restart) {
+    FILE *f;
+
+    printf("I: Switching to video level %d (%dx%d, %d fps, %d b/s)\n", level,
+        LEVELS[level].width, LEVELS[level].height, LEVELS[level].fps, LEVELS[level].bitrate);
+
+    if ((f = fopen(LEVEL_FILE, "w")) == NULL) {
+        perror("ERROR opening level file");
+        return;
+    }
+
+    fprintf(f, "CAM_WIDTH=%d\nCAM_HEIGHT=%d\nCAM_FPS=%d\nCAM_BITRATE=%d\n",
+        LEVELS[level].width, LEVELS[level].height, LEVELS[level].fps, LEVELS[level].bitrate);
+    fclose(f);
+
+    if (restart && system(RESTART_CMD) != 0)
+        fprintf(stderr, "ERROR: Restart command failed: %s\n", RESTART_CMD);
+}
+
+
+// Get the level written into the level file by the previous run (the stream
+// was started with it). Returns -1 if there is no level file and LEVELS_NUM if
+// it doesn't match any of the levels.
+int read_level() {
+    struct level l;
+    FILE *f;
+    int i, n;
+
+    if ((f = fopen(LEVEL_FILE, "r")) == NULL)
+        return -1;
+
+    n = fscanf(f, "CAM_WIDTH=%d\nCAM_HEIGHT=%d\nCAM_FPS=%d\nCAM_BITRATE=%d\n",
+        &l.width, &l.height, &l.fps, &l.bitrate);
+    fclose(f);
+
+    for (i=0; i<LEVELS_NUM && n == 4; i++) {
+        if (memcmp(&l, &LEVELS[i], sizeof l) == 0)
+            return i;
+    }
+
+    return LEVELS_NUM;
+}
+
+
+// Parse the level definition in format WIDTHxHEIGHT@FPS:BITRATE
+void add_level(char *arg) {
+    static int reset = 0;
+    struct level *l;
+
+    // The first level from the command line replaces the default ones
+    if (! reset) {
+        LEVELS_NUM = 0;
+        reset = 1;
+    }
+
+    if (LEVELS_NUM >= MAX_LEVELS) {
+        fprintf(stderr, "ERROR: Max %d levels allowed\n", MAX_LEVELS);
+        exit(EXIT_FAILURE);
+    }
+
+    l = &LEVELS[LEVELS_NUM];
+
+    if (sscanf(arg, "%dx%d@%d:%d", &l->width, &l->height, &l->fps, &l->bitrate) != 4) {
+        fprintf(stderr, "ERROR: Invalid level definition: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+
+    LEVELS_NUM++;
+}
+
+
+void usage(char *name) {
+    printf("Usage: %s [options]\n\n", name);
+    puts("Options:");
+    puts(" -c NUM  Control port number (default: 5001)");
+    puts(" -v NUM  Camera port number (default: 8160)");
+    puts(" -r NUM  Round-trip time in ms lowering the video level (default: 50)");
+    puts(" -q NUM  Camera send queue in bytes lowering the video level (default: 262144)");
+    puts(" -i NUM  Polling interval in ms (default: 500)");
+    puts(" -D NUM  Min time in s between lowering the level (default: 5)");
+    puts(" -U NUM  Time in s without congestion before raising the level (default: 10)");
+    puts(" -l STR  Video level in format WIDTHxHEIGHT@FPS:BITRATE, the best first,");
+    puts("         can be used multiple times (default: 800x400@24:2000000");
+    puts("         640x320@15:1000000 480x240@10:500000 320x160@5:200000)");
+    puts(" -f STR  Level file (default: /run/vlc-camera-stream.level)");
+    puts(" -x STR  Command restarting the camera stream");
+    puts("         (default: systemctl restart vlc-camera-stream.service)");
+    puts(" -d NUM  Debug level [0-1] (default: 0)");
+    puts(" -h      Show this help message and exit");
+}
+
+
+int main(int argc, char *argv[]) {
+    struct conn_stats stats;
+    long long now, last_change = 0, last_congestion = 0;
+    unsigned int rtt;
+    int level = 0;
+    int sock, c, congested, clear;
+
+    // Do not buffer STDOUT and STDERR
+    setbuf(stdout, NULL);
+    setbuf(stderr, NULL);
+
+    // Parse command line options
+    while ((c = getopt(argc, argv, "c:v:r:q:i:D:U:l:f:x:d:h")) != -1) {
+        switch (c) {
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+                break;
+            case 'c':
+                CONTROL_PORT = atoi(optarg);
+                break;
+            case 'v':
+                CAMERA_PORT = atoi(optarg);
+                break;
+            case 'r':
+                RTT_HIGH = atoi(optarg);
+                break;
+            case 'q':
+                QUEUE_HIGH = atoi(optarg);
+                break;
+            case 'i':
+                INTERVAL = atoi(optarg);
+                break;
+            case 'D':
+                DOWN_HOLD = atoi(optarg);
+                break;
+            case 'U':
+                UP_HOLD = atoi(optarg);
+                break;
+            case 'l':
+                add_level(optarg);
+                break;
+            case 'f':
+                LEVEL_FILE = optarg;
+                break;
+            case 'x':
+                RESTART_CMD = optarg;
+                break;
+            case 'd':
+                DEBUG = atoi(optarg);
+                break;
+            default:
+                abort();
+        }
+    }
+
+    if ((sock = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_SOCK_DIAG)) == -1) {
+        perror("ERROR opening netlink socket");
+        exit(EXIT_FAILURE);
+    }
+
+    level = read_level();
+
+    if (level == -1) {
+        // The stream runs with the CAM_RASPIVID_OPTIONS (the best level)
+        level = 0;
+        set_level(level, 0);
+    } else if (level == LEVELS_NUM) {
+        // The stream runs with a level which isn't defined any more
+        level = 0;
+        set_level(level, 1);
+    } else {
+        printf("I: Continuing with video level %d\n", level);
+    }
+
+    while (1) {
+        usleep(INTERVAL * 1000);
+
+        bzero((char *) &stats, sizeof(stats));
+
+        if (get_stats(sock, AF_INET, &stats) == -1 || get_stats(sock, AF_INET6, &stats) == -1) {
+            perror("ERROR on sock_diag");
+            exit(EXIT_FAILURE);
+        }
+
+        now = now_ms();
+
+        // The control traffic must come first (the control round-trip time
+        // is 0 if there was no fresh sample)
+        rtt = stats.control_rtt > stats.camera_rtt ? stats.control_rtt : stats.camera_rtt;
+        congested = rtt > RTT_HIGH * 1000 || stats.camera_queue > QUEUE_HIGH;
+        clear = rtt < RTT_HIGH * 500 && stats.camera_queue < QUEUE_HIGH / 4;
+
+        if (DEBUG > 0)
+            printf("D: control=%d rtt=%u us, camera=%d rtt=%u us queue=%u B, level=%d%s\n",
+                stats.control_conns, stats.control_rtt, stats.camera_conns, stats.camera_rtt,
+                stats.camera_queue, level, congested ? " (congested)" : "");
+
+        if (! clear)
+            last_congestion = now;
+
+        if (congested && level < LEVELS_NUM - 1 && now - last_change >= DOWN_HOLD * 1000) {
+            set_level(++level, 1);
+            last_change = now;
+        } else if (level > 0 && now - last_congestion >= UP_HOLD * 1000 &&
+                now - last_change >= UP_HOLD * 1000) {
+            set_level(--level, 1);
+            last_change = now;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,11 +1,16 @@
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termio.h>
+#include <time.h>
 #include <unistd.h>
+#include <netdb.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
@@ -13,6 +18,47 @@
 // Max number of bytes we can get at once
 #define MAXDATASIZE 100
 
+// Stop keycode
+#define KEYCODE_STOP '5'
+
+// System-wide config file with the default options (can be changed by the
+// LEGOIRC_CLIENT_CONF environment variable)
+#define CONFIG_FILE "/etc/conf.d/legoirc-client.conf"
+
+// Config file of the user (relative to the XDG_CONFIG_HOME or ~/.config)
+#define USER_CONFIG_FILE "legoirc-client.conf"
+
+// Max number of the options in the config file
+#define MAX_CONFIG_ARGS 32
+
+
+// Debug variable
+int DEBUG = 0;
+
+// Server address
+char *HOST = NULL;
+int PORT = 5001;
+
+// Keep-alive refresh of the held direction (in milliseconds)
+int KEEPALIVE = 500;
+
+// Interval of the time requests (in milliseconds). The server replies to them
+// so the round-trip time of the control connection is measured by its kernel
+// (used by the legoirc-bwmgr). 0 disables the requests.
+int TIME_REQUEST = 500;
+
+// The key is considered released if it doesn't repeat within this time (in
+// milliseconds). The first repetition comes after the auto-repeat delay of the
+// terminal (660 ms by default in Xorg), the others much faster. 0 disables the
+// automatic STOP.
+int REPEAT_DELAY = 700;
+int REPEAT_TIMEOUT = 150;
+
+// Socket tuning of the control connection
+int SOCK_NODELAY = 1;
+int SOCK_PRIORITY = 6;
+int SOCK_DSCP = 46;
+
 
 // FROM: http://c-faq.com/osdep/cbreak.html
 static struct termio saved_modes;
@@ -70,73 +116,274 @@ void *get_in_addr(struct sockaddr *sa) {
 }
 
 
+// Apply the low-latency options to the socket (failures are not fatal)
+void set_sock_opts(int sock, int family) {
+    int tos = SOCK_DSCP << 2;
+
+    // Send each key immediately (disable Nagle)
+    if (SOCK_NODELAY && setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &SOCK_NODELAY, sizeof(SOCK_NODELAY)) == -1)
+        perror("WARNING on setsockopt(TCP_NODELAY)");
+
+    // Prioritize the control traffic on the host
+    if (SOCK_PRIORITY > 0 && setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &SOCK_PRIORITY, sizeof(SOCK_PRIORITY)) == -1)
+        perror("WARNING on setsockopt(SO_PRIORITY)");
+
+    // Mark the control traffic for the network (DSCP in the upper 6 bits)
+    if (SOCK_DSCP > 0) {
+        if (family == AF_INET6) {
+            if (setsockopt(sock, IPPROTO_IPV6, IPV6_TCLASS, &tos, sizeof(tos)) == -1)
+                perror("WARNING on setsockopt(IPV6_TCLASS)");
+        } else if (setsockopt(sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) == -1) {
+            perror("WARNING on setsockopt(IP_TOS)");
+        }
+    }
+}
+
+
+long long now_ms() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+int is_direction(int keycode) {
+    return keycode >= '1' && keycode <= '9' && keycode != KEYCODE_STOP;
+}
+
+
+// Send the key as a line
+void send_key(int sock, int keycode) {
+    char str[2] = {keycode, '\n'};
+
+    // The quit message is just a newline
+    if (keycode == 'q') {
+        str[0] = '\n';
+    }
+
+    if (write(sock, str, keycode == 'q' ? 1 : 2) == -1) {
+        perror("ERROR on writing to socket");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+// Send the time request (the reply is ignored)
+void send_time_request(int sock, long id) {
+    char str[32];
+    int n;
+
+    n = snprintf(str, sizeof str, "T%ld\n", id);
+
+    if (write(sock, str, n) == -1) {
+        perror("ERROR on writing to socket");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
 void usage(char *name) {
     printf("Usage: %s [options]\n\n", name);
     puts("Options:");
-    puts(" -s STR  Server IP");
+    puts(" -s STR  Server IP or host name");
     puts(" -p NUM  Server port number (default: 5001)");
+    puts(" -k NUM  Keep-alive refresh of the held direction in ms (default: 500)");
+    puts(" -r NUM  Release timeout before the first key repeat in ms, 0 to");
+    puts("         disable the automatic STOP (default: 700)");
+    puts(" -R NUM  Release timeout between the key repeats in ms (default: 150)");
+    puts(" -t NUM  Time request interval in ms, 0 to disable (default: 500)");
+    puts(" -n      Don't disable the Nagle's algorithm (TCP_NODELAY)");
+    puts(" -N      Disable the Nagle's algorithm (default, overrides -n)");
+    puts(" -P NUM  Socket priority, 0 to disable (default: 6)");
+    puts(" -T NUM  DSCP value of the control traffic, 0 to disable (default: 46)");
+    puts(" -d NUM  Debug level [0-1] (default: 0)");
     puts(" -h      Show this help message and exit");
+    puts("");
+    puts("The default options can be set in " CONFIG_FILE " and overridden");
+    puts("in ~/.config/" USER_CONFIG_FILE " and on the command line.");
 }
 
 
-int main(int argc, char *argv[]) {
-    struct sockaddr_in server;
-    char str[2] = "\n\n";
-    char *host = NULL;
-    int port = 5001;
-    int sock, keycode, c;
-
-    // Parse command line options
-    while ((c = getopt(argc, argv, "s:p:h")) != -1) {
+// Parse the command line options (also the ones from the config files)
+void parse_opts(int argc, char **argv) {
+    int c;
+
+    // Start the parsing from the beginning
+    optind = 1;
+
+    while ((c = getopt(argc, argv, "s:p:k:r:R:t:nNP:T:d:h")) != -1) {
         switch (c) {
             case 'h':
                 usage(argv[0]);
                 exit(EXIT_SUCCESS);
                 break;
             case 's':
-                host = optarg;
+                HOST = optarg;
                 break;
             case 'p':
-                port = atoi(optarg);
+                PORT = atoi(optarg);
+                break;
+            case 'k':
+                KEEPALIVE = atoi(optarg);
+                break;
+            case 'r':
+                REPEAT_DELAY = atoi(optarg);
+                break;
+            case 'R':
+                REPEAT_TIMEOUT = atoi(optarg);
+                break;
+            case 't':
+                TIME_REQUEST = atoi(optarg);
+                break;
+            case 'n':
+                SOCK_NODELAY = 0;
+                break;
+            case 'N':
+                SOCK_NODELAY = 1;
+                break;
+            case 'P':
+                SOCK_PRIORITY = atoi(optarg);
+                break;
+            case 'T':
+                SOCK_DSCP = atoi(optarg);
+                break;
+            case 'd':
+                DEBUG = atoi(optarg);
                 break;
             default:
                 abort();
         }
     }
+}
+
+
+// Read the options from the OPTIONS variable of the config file (if it
+// exists) and parse them as the command line options
+void read_config(char *path, char *name) {
+    static char *args[MAX_CONFIG_ARGS + 2];
+    char line[1024];
+    char *opts = NULL, *arg, *end;
+    int n = 1;
+    FILE *f;
+
+    if ((f = fopen(path, "r")) == NULL)
+        return;
+
+    while (fgets(line, sizeof line, f) != NULL) {
+        if (strncmp(line, "OPTIONS=", 8) == 0) {
+            opts = line + 8;
+            break;
+        }
+    }
+
+    fclose(f);
+
+    if (opts == NULL)
+        return;
+
+    // Remove the quotes
+    opts[strcspn(opts, "\r\n")] = '\0';
+    if (opts[0] == '"' && (end = strrchr(opts + 1, '"')) != NULL) {
+        *end = '\0';
+        opts++;
+    }
+
+    // The option values are used after the return
+    if ((opts = strdup(opts)) == NULL)
+        return;
+
+    args[0] = name;
+
+    for (arg = strtok(opts, " \t"); arg != NULL && n <= MAX_CONFIG_ARGS; arg = strtok(NULL, " \t"))
+        args[n++] = arg;
+
+    args[n] = NULL;
+
+    parse_opts(n, args);
+}
+
+
+int main(int argc, char *argv[]) {
+    struct addrinfo hints, *servinfo, *p;
+    struct pollfd fds[2];
+    char buf[MAXDATASIZE];
+    char service[6];
+    char path[1024];
+    int sock, rv, n, i, timeout;
+    // Currently held key, the last sent key and whether the key repeats
+    int key = KEYCODE_STOP, sent_key = KEYCODE_STOP, repeating = 0, quit = 0;
+    long long now, key_time = 0, sent_time = 0, release_time, refresh_time, request_time = 0;
+    long keys = 0, writes = 0, requests = 0;
+
+    // Options from the config files first, the later ones take precedence
+    read_config(getenv("LEGOIRC_CLIENT_CONF") != NULL ? getenv("LEGOIRC_CLIENT_CONF") : CONFIG_FILE, argv[0]);
+
+    if (getenv("XDG_CONFIG_HOME") != NULL) {
+        snprintf(path, sizeof path, "%s/%s", getenv("XDG_CONFIG_HOME"), USER_CONFIG_FILE);
+        read_config(path, argv[0]);
+    } else if (getenv("HOME") != NULL) {
+        snprintf(path, sizeof path, "%s/.config/%s", getenv("HOME"), USER_CONFIG_FILE);
+        read_config(path, argv[0]);
+    }
+
+    parse_opts(argc, argv);
 
     // Check if server IP is defined
-    if (host == NULL) {
+    if (HOST == NULL) {
         puts("ERROR: Server IP not specified.\n");
         usage(argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    printf("Connecting to %s:%d\n", host, port);
+    printf("Connecting to %s:%d\n", HOST, PORT);
+
+    // Resolve the server address (IPv4 or IPv6)
+    bzero((char *) &hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", PORT);
 
-    // Create socket
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        perror("ERROR opening socket");
+    if ((rv = getaddrinfo(HOST, service, &hints, &servinfo)) != 0) {
+        fprintf(stderr, "ERROR on getaddrinfo: %s\n", gai_strerror(rv));
         exit(EXIT_FAILURE);
     }
 
-    // Initialize socket
-    bzero((char *) &server, sizeof(server));
-    server.sin_family = AF_INET;
-    server.sin_addr.s_addr = inet_addr(host);
-    server.sin_port = htons(port);
-
     // Catch interuption signal
     if (signal(SIGINT, int_handler) == SIG_ERR) {
         perror("ERROR on setting signal");
         exit(EXIT_FAILURE);
     }
 
-    // Connect to the server
-    if (connect(sock, (struct sockaddr *) &server, sizeof(server)) == -1) {
-        perror("ERROR on connect");
+    // Connect to the first address which works
+    for (p = servinfo; p != NULL; p = p->ai_next) {
+        // Create socket
+        if ((sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
+            perror("ERROR opening socket");
+            continue;
+        }
+
+        // Tune the control connection for low latency
+        set_sock_opts(sock, p->ai_family);
+
+        // Connect to the server
+        if (connect(sock, p->ai_addr, p->ai_addrlen) == -1) {
+            perror("ERROR on connect");
+            close(sock);
+            continue;
+        }
+
+        break;
+    }
+
+    if (p == NULL) {
+        fputs("ERROR: Failed to connect\n", stderr);
         exit(EXIT_FAILURE);
     }
 
+    freeaddrinfo(servinfo);
+
     // Disable new line and echo while reading keys
     if (tty_break() == -1) {
         perror("ERROR on tty break");
@@ -145,32 +392,123 @@ int main(int argc, char *argv[]) {
 
     puts("Quit by pressing 'q' key.");
 
-    // Read keys in infinite loop (untill pressed "q" or CRTL+C)
-    while (1) {
-        // Read code from the keyboard
-        keycode = getchar();
-
-        if (keycode == 'q') {
-            // Last message is newline
-            str[0] = '\n';
-        } else {
-            // Convert the keycode to a character of the string
-            str[0] = keycode;
+    fds[0].fd = fileno(stdin);
+    fds[0].events = POLLIN;
+    fds[1].fd = sock;
+    fds[1].events = POLLIN;
+
+    // Read keys in infinite loop (untill pressed "q" or CRTL+C). Only the
+    // changes of the held key and the keep-alive refreshes are sent.
+    while (! quit) {
+        now = now_ms();
+        timeout = -1;
+
+        // Wake up for the release of the key or for the keep-alive refresh
+        if (is_direction(key)) {
+            release_time = key_time + (repeating ? REPEAT_TIMEOUT : REPEAT_DELAY);
+            refresh_time = sent_time + KEEPALIVE;
+
+            if (REPEAT_DELAY > 0 && release_time < refresh_time) {
+                timeout = release_time - now;
+            } else {
+                timeout = refresh_time - now;
+            }
+
+            if (timeout < 0)
+                timeout = 0;
+        }
+
+        // Wake up for the next time request
+        if (TIME_REQUEST > 0 && (timeout == -1 || request_time + TIME_REQUEST - now < timeout)) {
+            timeout = request_time + TIME_REQUEST - now;
+
+            if (timeout < 0)
+                timeout = 0;
         }
 
-        // Write the string to the socket
-        if (write(sock, str, strlen(str)) == -1) {
-            perror("ERROR on writing to socket");
+        if (poll(fds, 2, timeout) == -1) {
+            perror("ERROR on poll");
             exit(EXIT_FAILURE);
         }
 
-        // Finish when pressed "q"
-        if (keycode == 'q') {
+        now = now_ms();
+
+        // Drop the replies to the time requests
+        if (fds[1].revents & (POLLIN | POLLHUP)) {
+            if ((n = read(sock, buf, sizeof buf)) == -1) {
+                perror("ERROR reading from socket");
+                exit(EXIT_FAILURE);
+            }
+
+            if (n == 0) {
+                puts("Connection closed by server");
+                break;
+            }
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            // Read all queued keys at once
+            if ((n = read(fds[0].fd, buf, sizeof buf)) == -1) {
+                perror("ERROR reading keys");
+                exit(EXIT_FAILURE);
+            }
+
+            // End of the input is the same as "q"
+            if (n == 0) {
+                buf[n++] = 'q';
+            }
+
+            keys += n;
+
+            for (i=0; i<n; i++) {
+                if (buf[i] == 'q') {
+                    quit = 1;
+                    break;
+                } else if (buf[i] == key && is_direction(key)) {
+                    repeating = 1;
+                } else if (is_direction(buf[i]) || buf[i] == KEYCODE_STOP) {
+                    key = buf[i];
+                    repeating = 0;
+                } else {
+                    // Other commands (e.g. "X") are sent as they are
+                    send_key(sock, buf[i]);
+                    writes++;
+                }
+
+                key_time = now;
+            }
+        }
+
+        // The key was released
+        if (REPEAT_DELAY > 0 && is_direction(key) &&
+                now - key_time >= (repeating ? REPEAT_TIMEOUT : REPEAT_DELAY)) {
+            key = KEYCODE_STOP;
+            repeating = 0;
+        }
+
+        if (quit) {
+            // Finish when pressed "q"
+            send_key(sock, 'q');
+            writes++;
+
             puts("Closing connection");
-            break;
+        } else if (key != sent_key || (is_direction(key) && now - sent_time >= KEEPALIVE)) {
+            send_key(sock, key);
+            writes++;
+
+            sent_key = key;
+            sent_time = now;
+        }
+
+        if (! quit && TIME_REQUEST > 0 && now - request_time >= TIME_REQUEST) {
+            send_time_request(sock, requests++);
+            request_time = now;
         }
     }
 
+    if (DEBUG > 0)
+        printf("D: Sent %ld messages for %ld keys and %ld time requests\n", writes, keys, requests);
+
     // Restore the original console I/O modes
     if (tty_fix() == -1) {
         perror("ERROR on restoring tty");
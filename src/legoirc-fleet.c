@@ -0,0 +1,608 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+
+// Max number of the servers
+#define MAX_SERVERS 16
+
+// Number of the time samples kept for each server
+#define SAMPLES 8
+
+// Max length of the line from the server and of the command
+#define BUFSIZE 256
+
+// Number of the commands waiting for the reply from all servers
+#define MAX_PENDING 16
+
+
+// Debug variable
+int DEBUG = 0;
+
+// Time between the command and its deadline (in milliseconds). It must be
+// longer than the round-trip time plus the longest wait of the IR transmitter.
+int LEAD = 400;
+
+// Time synchronization interval (in milliseconds)
+int SYNC_INTERVAL = 1000;
+
+// Keep-alive refresh of the last command (in milliseconds)
+int KEEPALIVE = 500;
+
+// Time sample (server clock minus our clock and the round-trip time)
+struct sample {
+    long long offset;
+    long long rtt;
+};
+
+// Connection to the server
+struct server {
+    char *host;
+    char *port;
+    int sock;
+    // Time and sequence of the time request waiting for the reply
+    long long ping_time;
+    int ping_seq;
+    // The last time samples and the best estimate
+    struct sample samples[SAMPLES];
+    int samples_num;
+    long long offset;
+    long long rtt;
+    // Unfinished line read from the socket
+    char buf[BUFSIZE];
+    int buf_len;
+};
+
+struct server SERVERS[MAX_SERVERS];
+int SERVERS_NUM = 0;
+
+// Scheduled command waiting for the replies (the deadline is in our clock)
+struct pending {
+    long long deadline;
+    char cmd[BUFSIZE];
+    // Deadline in the clock of each server and the time it sent the command
+    long long server_deadline[MAX_SERVERS];
+    long long sent[MAX_SERVERS];
+    int replies;
+    int expected;
+};
+
+struct pending PENDING[MAX_PENDING];
+
+// Statistics of the achieved skew and the delay after the deadline (in
+// nanoseconds)
+long long SKEW_MAX = 0, SKEW_SUM = 0, LATE_MAX = 0, LATE_SUM = 0;
+int CMDS_NUM = 0;
+
+
+long long now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Connect to the server (the first address which works)
+int connect_server(struct server *s) {
+    struct addrinfo hints, *servinfo, *p;
+    int yes = 1;
+    int rv;
+
+    bzero((char *) &hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ((rv = getaddrinfo(s->host, s->port, &hints, &servinfo)) != 0) {
+        fprintf(stderr, "ERROR on getaddrinfo: %s\n", gai_strerror(rv));
+        return -1;
+    }
+
+    for (p = servinfo; p != NULL; p = p->ai_next) {
+        if ((s->sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
+            continue;
+
+        // Send the short messages immediately
+        setsockopt(s->sock, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        if (connect(s->sock, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+
+        close(s->sock);
+    }
+
+    freeaddrinfo(servinfo);
+
+    if (p == NULL) {
+        s->sock = -1;
+        return -1;
+    }
+
+    s->samples_num = 0;
+    s->ping_time = 0;
+    s->buf_len = 0;
+
+    printf("I: Connected to %s:%s\n", s->host, s->port);
+
+    return 0;
+}
+
+
+void disconnect_server(struct server *s) {
+    printf("I: Disconnected from %s:%s\n", s->host, s->port);
+
+    close(s->sock);
+    s->sock = -1;
+}
+
+
+// Write the whole line to the server
+void send_line(struct server *s, char *line) {
+    int len = strlen(line);
+    int written, n;
+
+    for (written = 0; written < len; written += n) {
+        if ((n = write(s->sock, line + written, len - written)) == -1) {
+            perror("ERROR writing to socket");
+            disconnect_server(s);
+            return;
+        }
+    }
+}
+
+
+// Send the time request (only one can wait for the reply)
+void send_ping(struct server *s) {
+    char line[BUFSIZE];
+
+    if (s->sock == -1 || s->ping_time != 0)
+        return;
+
+    s->ping_seq++;
+    snprintf(line, sizeof line, "T%d\n", s->ping_seq);
+
+    s->ping_time = now_ns();
+    send_line(s, line);
+}
+
+
+// Process the reply to the time request. The offset of the server clock is
+// taken from the sample with the lowest round-trip time as it's the least
+// affected by the queuing.
+void add_sample(struct server *s, int seq, long long server_time) {
+    long long now = now_ns();
+    struct sample *sample;
+    int i;
+
+    if (seq != s->ping_seq || s->ping_time == 0)
+        return;
+
+    sample = &s->samples[s->samples_num % SAMPLES];
+    sample->rtt = now - s->ping_time;
+    sample->offset = server_time - (s->ping_time + now) / 2;
+    s->samples_num++;
+    s->ping_time = 0;
+
+    s->offset = s->samples[0].offset;
+    s->rtt = s->samples[0].rtt;
+
+    for (i=1; i<SAMPLES && i<s->samples_num; i++) {
+        if (s->samples[i].rtt < s->rtt) {
+            s->offset = s->samples[i].offset;
+            s->rtt = s->samples[i].rtt;
+        }
+    }
+
+    if (DEBUG > 1)
+        printf("D: %s:%s sample rtt=%lld us offset=%lld us, estimate rtt=%lld us offset=%lld us\n",
+            s->host, s->port, sample->rtt / 1000, sample->offset / 1000, s->rtt / 1000, s->offset / 1000);
+
+    // Fill all samples quickly after the connect
+    if (s->samples_num < SAMPLES)
+        send_ping(s);
+}
+
+
+// Report the skew of the command once all servers replied
+void check_pending(struct pending *p, int force) {
+    long long first = 0, last = 0, late = 0;
+    int i, n = 0;
+
+    if (p->expected == 0 || (p->replies < p->expected && ! force))
+        return;
+
+    for (i=0; i<SERVERS_NUM; i++) {
+        if (p->sent[i] <= 0)
+            continue;
+
+        if (n == 0 || p->sent[i] < first)
+            first = p->sent[i];
+
+        if (n == 0 || p->sent[i] > last)
+            last = p->sent[i];
+
+        if (p->sent[i] - p->deadline > late)
+            late = p->sent[i] - p->deadline;
+
+        n++;
+    }
+
+    if (n > 0) {
+        printf("I: Command >%s< sent by %d/%d servers, skew %lld us, max delay %lld us\n",
+            p->cmd, n, p->expected, (last - first) / 1000, late / 1000);
+
+        CMDS_NUM++;
+        SKEW_SUM += last - first;
+        LATE_SUM += late;
+
+        if (last - first > SKEW_MAX)
+            SKEW_MAX = last - first;
+
+        if (late > LATE_MAX)
+            LATE_MAX = late;
+    } else {
+        printf("I: Command >%s< was not sent by any server\n", p->cmd);
+    }
+
+    p->expected = 0;
+}
+
+
+// Process the reply to the scheduled command (the time is converted to our
+// clock)
+void add_reply(int index, long long deadline, long long sent) {
+    struct server *s = &SERVERS[index];
+    int i;
+
+    for (i=0; i<MAX_PENDING; i++) {
+        if (PENDING[i].expected > 0 && PENDING[i].server_deadline[index] == deadline) {
+            PENDING[i].sent[index] = sent ? sent - s->offset : -1;
+            PENDING[i].replies++;
+
+            if (DEBUG > 0)
+                printf("D: %s:%s sent >%s< %lld us after the deadline\n", s->host, s->port,
+                    PENDING[i].cmd, sent ? (sent - deadline) / 1000 : 0);
+
+            check_pending(&PENDING[i], 0);
+
+            return;
+        }
+    }
+}
+
+
+// Read the replies of the server
+void read_server(int index) {
+    struct server *s = &SERVERS[index];
+    long long a, b;
+    char *line, *end;
+    int n, seq;
+
+    if ((n = read(s->sock, s->buf + s->buf_len, sizeof(s->buf) - s->buf_len - 1)) <= 0) {
+        if (n == -1)
+            perror("ERROR reading from socket");
+
+        disconnect_server(s);
+        return;
+    }
+
+    s->buf_len += n;
+    s->buf[s->buf_len] = '\0';
+
+    for (line = s->buf; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+        *end = '\0';
+
+        if (sscanf(line, "T%d %lld", &seq, &a) == 2) {
+            add_sample(s, seq, a);
+        } else if (sscanf(line, "@%lld %lld", &a, &b) == 2) {
+            add_reply(index, a, b);
+        } else if (DEBUG > 0) {
+            printf("D: Unknown reply from %s:%s: >%s<\n", s->host, s->port, line);
+        }
+    }
+
+    // Keep the unfinished line
+    s->buf_len -= line - s->buf;
+    memmove(s->buf, line, s->buf_len);
+
+    // Drop too long line
+    if (s->buf_len >= (int) sizeof(s->buf) - 1)
+        s->buf_len = 0;
+}
+
+
+// Send the command to all servers so they send it at the same time
+void schedule(char *cmd) {
+    static int next = 0;
+    struct pending *p = &PENDING[next];
+    char line[BUFSIZE];
+    int i;
+
+    next = (next + 1) % MAX_PENDING;
+
+    // The oldest command is reported with the replies received so far
+    check_pending(p, 1);
+
+    bzero((char *) p, sizeof(*p));
+    p->deadline = now_ns() + (long long) LEAD * 1000000;
+    snprintf(p->cmd, sizeof(p->cmd), "%s", cmd);
+
+    for (i=0; i<SERVERS_NUM; i++) {
+        if (SERVERS[i].sock == -1 || SERVERS[i].samples_num == 0)
+            continue;
+
+        // Deadline in the clock of the server
+        p->server_deadline[i] = p->deadline + SERVERS[i].offset;
+        snprintf(line, sizeof line, "@%lld %s\n", p->server_deadline[i], cmd);
+        send_line(&SERVERS[i], line);
+
+        if (SERVERS[i].sock != -1)
+            p->expected++;
+    }
+
+    if (DEBUG > 0)
+        printf("D: Command >%s< scheduled for %d servers\n", cmd, p->expected);
+}
+
+
+// Check whether there is at least one time sample of each connected server
+int synchronized() {
+    int i;
+
+    for (i=0; i<SERVERS_NUM; i++) {
+        if (SERVERS[i].sock != -1 && SERVERS[i].samples_num == 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+
+// Check whether any command waits for the replies
+int any_pending() {
+    int i;
+
+    for (i=0; i<MAX_PENDING; i++) {
+        if (PENDING[i].expected > 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+// Refresh the last command (the receiver stops the motors if it doesn't get
+// any message for a while)
+void refresh(char *cmd) {
+    char line[BUFSIZE];
+    int i;
+
+    snprintf(line, sizeof line, "%s\n", cmd);
+
+    for (i=0; i<SERVERS_NUM; i++) {
+        if (SERVERS[i].sock != -1)
+            send_line(&SERVERS[i], line);
+    }
+}
+
+
+// Parse the server in format HOST:PORT (IPv6 address in brackets)
+void add_server(char *arg) {
+    struct server *s;
+    char *colon = strrchr(arg, ':');
+
+    if (SERVERS_NUM >= MAX_SERVERS) {
+        fprintf(stderr, "ERROR: Max %d servers allowed\n", MAX_SERVERS);
+        exit(EXIT_FAILURE);
+    }
+
+    s = &SERVERS[SERVERS_NUM];
+    bzero((char *) s, sizeof(*s));
+    s->sock = -1;
+
+    if (colon == NULL) {
+        s->host = arg;
+        s->port = "5001";
+    } else {
+        *colon = '\0';
+        s->host = arg;
+        s->port = colon + 1;
+    }
+
+    if (s->host[0] == '[' && s->host[strlen(s->host) - 1] == ']') {
+        s->host[strlen(s->host) - 1] = '\0';
+        s->host++;
+    }
+
+    SERVERS_NUM++;
+}
+
+
+void usage(char *name) {
+    printf("Usage: %s [options]\n\n", name);
+    puts("Reads the commands from STDIN and sends them to all servers so that");
+    puts("all vehicles execute them at the same time.\n");
+    puts("Options:");
+    puts(" -s STR  Server in format HOST[:PORT], can be used multiple times");
+    puts(" -l NUM  Time between the command and its execution in ms (default: 400)");
+    puts(" -i NUM  Time synchronization interval in ms (default: 1000)");
+    puts(" -k NUM  Keep-alive refresh of the last command in ms, 0 to disable (default: 500)");
+    puts(" -d NUM  Debug level [0-2] (default: 0)");
+    puts(" -h      Show this help message and exit");
+}
+
+
+int main(int argc, char *argv[]) {
+    struct pollfd fds[MAX_SERVERS + 1];
+    char input[BUFSIZE], last_cmd[BUFSIZE] = "";
+    char *line, *end;
+    long long now, next_sync = 0, next_refresh = 0, exit_time = 0;
+    int c, i, n, timeout, input_len = 0;
+
+    // Do not buffer STDOUT and STDERR
+    setbuf(stdout, NULL);
+    setbuf(stderr, NULL);
+
+    // Parse command line options
+    while ((c = getopt(argc, argv, "s:l:i:k:d:h")) != -1) {
+        switch (c) {
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+                break;
+            case 's':
+                add_server(optarg);
+                break;
+            case 'l':
+                LEAD = atoi(optarg);
+                break;
+            case 'i':
+                SYNC_INTERVAL = atoi(optarg);
+                break;
+            case 'k':
+                KEEPALIVE = atoi(optarg);
+                break;
+            case 'd':
+                DEBUG = atoi(optarg);
+                break;
+            default:
+                abort();
+        }
+    }
+
+    if (SERVERS_NUM == 0) {
+        puts("ERROR: No server specified.\n");
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    while (1) {
+        now = now_ns();
+
+        // Reconnect and synchronize the clocks
+        if (now >= next_sync) {
+            for (i=0; i<SERVERS_NUM; i++) {
+                if (SERVERS[i].sock == -1 && connect_server(&SERVERS[i]) == -1)
+                    continue;
+
+                // Drop the request which wasn't answered
+                if (SERVERS[i].ping_time != 0 && now - SERVERS[i].ping_time > (long long) SYNC_INTERVAL * 1000000)
+                    SERVERS[i].ping_time = 0;
+
+                send_ping(&SERVERS[i]);
+
+                if (DEBUG > 0 && SERVERS[i].samples_num > 0)
+                    printf("D: %s:%s rtt=%lld us offset=%lld us\n", SERVERS[i].host, SERVERS[i].port,
+                        SERVERS[i].rtt / 1000, SERVERS[i].offset / 1000);
+            }
+
+            next_sync = now + (long long) SYNC_INTERVAL * 1000000;
+        }
+
+        // Refresh the last command after its deadline
+        if (KEEPALIVE > 0 && last_cmd[0] != '\0' && now >= next_refresh) {
+            refresh(last_cmd);
+            next_refresh = now + (long long) KEEPALIVE * 1000000;
+        }
+
+        // Exit once all commands were reported (the servers wait max 1 s
+        // after the deadline)
+        if (exit_time != 0 && (now >= exit_time || ! any_pending()))
+            break;
+
+        // Read the commands only when the clocks of all servers are known
+        fds[0].fd = exit_time == 0 && synchronized() ? STDIN_FILENO : -1;
+        fds[0].events = POLLIN;
+
+        for (i=0; i<SERVERS_NUM; i++) {
+            fds[i + 1].fd = SERVERS[i].sock;
+            fds[i + 1].events = POLLIN;
+        }
+
+        timeout = (next_sync - now) / 1000000;
+
+        if (KEEPALIVE > 0 && last_cmd[0] != '\0' && (next_refresh - now) / 1000000 < timeout)
+            timeout = (next_refresh - now) / 1000000;
+
+        if (poll(fds, SERVERS_NUM + 1, timeout < 0 ? 0 : timeout + 1) == -1) {
+            if (errno == EINTR)
+                continue;
+
+            perror("ERROR on poll");
+            exit(EXIT_FAILURE);
+        }
+
+        for (i=0; i<SERVERS_NUM; i++) {
+            if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+                read_server(i);
+        }
+
+        // New commands (not buffered by the stdio so no line is left
+        // unprocessed until the next wake up)
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            if ((n = read(STDIN_FILENO, input + input_len, sizeof(input) - input_len - 1)) == -1) {
+                if (errno == EINTR)
+                    continue;
+
+                perror("ERROR reading commands");
+            }
+
+            // End of the input finishes the last line
+            if (n <= 0) {
+                exit_time = now_ns() + (long long) (LEAD + 1000) * 1000000;
+                input[input_len] = '\n';
+                n = 1;
+            }
+
+            input_len += n;
+            input[input_len] = '\0';
+
+            for (line = input; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+                *end = '\0';
+                line[strcspn(line, "\r")] = '\0';
+
+                if (line[0] == '\0')
+                    continue;
+
+                schedule(line);
+
+                strcpy(last_cmd, line);
+
+                // Don't replace the scheduled command before its deadline
+                next_refresh = now_ns() + (long long) (LEAD + KEEPALIVE) * 1000000;
+            }
+
+            // Don't refresh the last command after the end of the input
+            if (exit_time != 0)
+                last_cmd[0] = '\0';
+
+            // Keep the unfinished line
+            input_len -= line - input;
+            memmove(input, line, input_len);
+
+            // Drop too long line
+            if (input_len >= (int) sizeof(input) - 1)
+                input_len = 0;
+        }
+    }
+
+    for (i=0; i<MAX_PENDING; i++)
+        check_pending(&PENDING[i], 1);
+
+    if (CMDS_NUM > 0)
+        printf("I: %d commands: skew avg %lld us, max %lld us, delay avg %lld us, max %lld us\n",
+            CMDS_NUM, SKEW_SUM / CMDS_NUM / 1000, SKEW_MAX / 1000, LATE_SUM / CMDS_NUM / 1000,
+            LATE_MAX / 1000);
+
+    return EXIT_SUCCESS;
+}
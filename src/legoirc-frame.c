@@ -0,0 +1,170 @@
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "legoirc-frame.h"
+
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static struct legoirc_frame_buf *map_buf(const char *path, int flags, int prot) {
+    struct legoirc_frame_buf *buf;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, flags, 0644)) == -1)
+        return NULL;
+
+    if ((flags & O_CREAT) && ftruncate(fd, sizeof(struct legoirc_frame_buf)) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    // The writer may not have resized the file yet
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(struct legoirc_frame_buf)) {
+        close(fd);
+        return NULL;
+    }
+
+    buf = mmap(NULL, sizeof(struct legoirc_frame_buf), prot, MAP_SHARED, fd, 0);
+
+    // The mapping stays valid after the close
+    close(fd);
+
+    return buf == MAP_FAILED ? NULL : buf;
+}
+
+
+struct legoirc_frame_buf *legoirc_frame_open(const char *path) {
+    struct legoirc_frame_buf *buf = map_buf(path, O_RDONLY, PROT_READ);
+
+    if (buf == NULL)
+        return NULL;
+
+    if (__atomic_load_n(&buf->magic, __ATOMIC_ACQUIRE) != LEGOIRC_FRAME_MAGIC ||
+            buf->version != LEGOIRC_FRAME_VERSION) {
+        legoirc_frame_close(buf);
+        return NULL;
+    }
+
+    return buf;
+}
+
+
+const struct legoirc_frame *legoirc_frame_get(struct legoirc_frame_buf *buf, uint64_t *ticket) {
+    const struct legoirc_frame *frame;
+
+    if (__atomic_load_n(&buf->generation, __ATOMIC_ACQUIRE) == 0)
+        return NULL;
+
+    frame = &buf->slots[__atomic_load_n(&buf->latest, __ATOMIC_ACQUIRE)];
+    *ticket = __atomic_load_n(&frame->seq, __ATOMIC_ACQUIRE);
+
+    return frame;
+}
+
+
+const struct legoirc_frame *legoirc_frame_get_key(struct legoirc_frame_buf *buf, uint64_t *ticket) {
+    const struct legoirc_frame *frame;
+
+    if (__atomic_load_n(&buf->key_generation, __ATOMIC_ACQUIRE) == 0)
+        return NULL;
+
+    frame = &buf->key_slots[__atomic_load_n(&buf->key_latest, __ATOMIC_ACQUIRE)];
+    *ticket = __atomic_load_n(&frame->seq, __ATOMIC_ACQUIRE);
+
+    return frame;
+}
+
+
+int legoirc_frame_valid(const struct legoirc_frame *frame, uint64_t ticket) {
+    // The frame data must be read before the sequence is checked again
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return (ticket & 1) == 0 && __atomic_load_n(&frame->seq, __ATOMIC_RELAXED) == ticket;
+}
+
+
+void legoirc_frame_close(struct legoirc_frame_buf *buf) {
+    munmap(buf, sizeof(struct legoirc_frame_buf));
+}
+
+
+struct legoirc_frame_buf *legoirc_frame_create(const char *path) {
+    struct legoirc_frame_buf *buf = map_buf(path, O_RDWR | O_CREAT, PROT_READ | PROT_WRITE);
+
+    if (buf == NULL)
+        return NULL;
+
+    // Readers of the previous writer must not see a half initialized buffer
+    __atomic_store_n(&buf->magic, 0, __ATOMIC_RELEASE);
+
+    buf->version = LEGOIRC_FRAME_VERSION;
+    buf->generation = 0;
+    buf->latest = 0;
+    buf->key_generation = 0;
+    buf->key_latest = 0;
+
+    __atomic_store_n(&buf->magic, LEGOIRC_FRAME_MAGIC, __ATOMIC_RELEASE);
+
+    return buf;
+}
+
+
+static void write_slot(struct legoirc_frame *frame, const uint8_t *head, uint32_t head_size,
+        const uint8_t *data, uint32_t size, uint32_t flags, uint64_t generation, uint64_t time) {
+    uint64_t seq = frame->seq;
+
+    // Mark the slot as being written
+    __atomic_store_n(&frame->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (head_size > 0)
+        memcpy(frame->data, head, head_size);
+    memcpy(frame->data + head_size, data, size);
+
+    frame->size = head_size + size;
+    frame->flags = flags;
+    frame->generation = generation;
+    frame->time = time;
+
+    __atomic_store_n(&frame->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+int legoirc_frame_publish(struct legoirc_frame_buf *buf, const uint8_t *head, uint32_t head_size,
+        const uint8_t *data, uint32_t size, uint32_t flags) {
+    // The oldest slot (neither the newest nor the previous frame)
+    uint32_t index = (buf->latest + 1) % LEGOIRC_FRAME_SLOTS;
+    uint32_t key_index = (buf->key_latest + 1) % LEGOIRC_FRAME_KEY_SLOTS;
+    uint64_t generation = buf->generation + 1, time = now_ns();
+
+    if (head_size + size > LEGOIRC_FRAME_MAX_SIZE)
+        return -1;
+
+    // The previous key frame stays readable while the new one is written
+    if (flags & LEGOIRC_FRAME_KEY) {
+        write_slot(&buf->key_slots[key_index], head, head_size, data, size, flags, generation, time);
+
+        __atomic_store_n(&buf->key_latest, key_index, __ATOMIC_RELEASE);
+        __atomic_store_n(&buf->key_generation, generation, __ATOMIC_RELEASE);
+    }
+
+    write_slot(&buf->slots[index], head, head_size, data, size, flags, generation, time);
+
+    // Make it the newest frame
+    __atomic_store_n(&buf->latest, index, __ATOMIC_RELEASE);
+    __atomic_store_n(&buf->generation, generation, __ATOMIC_RELEASE);
+
+    return 0;
+}
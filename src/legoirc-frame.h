@@ -0,0 +1,112 @@
+// Latest camera frame in the shared memory
+//
+// The legoirc-framebuf sits in the camera pipeline and publishes each encoded
+// H.264 frame (access unit in the Annex B format) into a memory mapped triple
+// buffer. Processes running on the Raspberry Pi (e.g. a local vision process
+// or a snapshot HTTP endpoint) can read the newest frame without copying it
+// and without blocking the writer. The frames are never queued, the oldest
+// slot is always overwritten by the new frame. Key frames are prefixed by the
+// SPS and PPS so they can be decoded on their own. The frame is published as
+// soon as the next one starts in the stream.
+//
+// The following frames can't be decoded without the preceding key frame which
+// is overwritten in the triple buffer two frames later. Therefore the newest
+// key frame is also kept in its own double buffered slot until the next key
+// frame comes (legoirc_frame_get_key()), so a reader starting to decode the
+// stream can always get a decodable frame.
+//
+// The reader uses the frame in place and then checks that the writer didn't
+// overwrite it in the meantime:
+//
+//   struct legoirc_frame_buf *buf = legoirc_frame_open(LEGOIRC_FRAME_PATH);
+//   const struct legoirc_frame *frame;
+//   uint64_t ticket;
+//
+//   do {
+//       frame = legoirc_frame_get(buf, &ticket);
+//       ... use frame->data and frame->size ...
+//   } while (frame != NULL && ! legoirc_frame_valid(frame, ticket));
+
+#ifndef LEGOIRC_FRAME_H
+#define LEGOIRC_FRAME_H
+
+#include <stdint.h>
+
+
+// Default path of the buffer
+#define LEGOIRC_FRAME_PATH "/dev/shm/legoirc-frame"
+
+// Number of the frame slots
+#define LEGOIRC_FRAME_SLOTS 3
+
+// Number of the key frame slots
+#define LEGOIRC_FRAME_KEY_SLOTS 2
+
+// Max size of a single frame
+#define LEGOIRC_FRAME_MAX_SIZE (1024 * 1024)
+
+// Identification of the shared memory layout
+#define LEGOIRC_FRAME_MAGIC 0x4c474946
+#define LEGOIRC_FRAME_VERSION 2
+
+// Frame flags
+#define LEGOIRC_FRAME_KEY 1
+
+
+struct legoirc_frame {
+    // Odd while the writer writes into the slot
+    uint64_t seq;
+    // Generation of the frame (see legoirc_frame_buf)
+    uint64_t generation;
+    // Time when the frame was published (CLOCK_MONOTONIC in nanoseconds)
+    uint64_t time;
+    uint32_t size;
+    uint32_t flags;
+    uint8_t data[LEGOIRC_FRAME_MAX_SIZE] __attribute__((aligned(64)));
+};
+
+struct legoirc_frame_buf {
+    uint32_t magic;
+    uint32_t version;
+    // Number of the published frames
+    uint64_t generation;
+    // Slot with the newest frame
+    uint32_t latest;
+    // Key slot with the newest key frame
+    uint32_t key_latest;
+    // Generation of the newest key frame (0 if there is none yet)
+    uint64_t key_generation;
+    struct legoirc_frame slots[LEGOIRC_FRAME_SLOTS] __attribute__((aligned(64)));
+    struct legoirc_frame key_slots[LEGOIRC_FRAME_KEY_SLOTS] __attribute__((aligned(64)));
+};
+
+
+// Map the buffer for reading. Returns NULL on error.
+struct legoirc_frame_buf *legoirc_frame_open(const char *path);
+
+// Get the newest frame (NULL if there is none yet)
+const struct legoirc_frame *legoirc_frame_get(struct legoirc_frame_buf *buf, uint64_t *ticket);
+
+// Get the newest key frame (NULL if there is none yet), used the same way as
+// legoirc_frame_get()
+const struct legoirc_frame *legoirc_frame_get_key(struct legoirc_frame_buf *buf, uint64_t *ticket);
+
+// Check that the frame wasn't overwritten since legoirc_frame_get() or
+// legoirc_frame_get_key()
+int legoirc_frame_valid(const struct legoirc_frame *frame, uint64_t ticket);
+
+// Unmap the buffer
+void legoirc_frame_close(struct legoirc_frame_buf *buf);
+
+
+// Writer: create and map the buffer. Returns NULL on error.
+struct legoirc_frame_buf *legoirc_frame_create(const char *path);
+
+// Writer: publish the frame (the data can be split into two parts, e.g. the
+// SPS and PPS and the frame itself). The key frames (LEGOIRC_FRAME_KEY flag)
+// are also stored into the key slot. Returns 0 on success, -1 if the frame is
+// too big.
+int legoirc_frame_publish(struct legoirc_frame_buf *buf, const uint8_t *head, uint32_t head_size,
+    const uint8_t *data, uint32_t size, uint32_t flags);
+
+#endif
@@ -0,0 +1,252 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "legoirc-frame.h"
+
+
+// Size of the read buffer
+#define BUFSIZE 65536
+
+// Max size of the SPS, PPS and SEI before the key frame
+#define MAX_HEAD_SIZE 1024
+
+// H.264 NAL unit types
+#define NAL_SLICE 1
+#define NAL_IDR 5
+#define NAL_SEI 6
+#define NAL_SPS 7
+#define NAL_PPS 8
+#define NAL_AUD 9
+
+
+// Debug variable
+int DEBUG = 0;
+
+// Frame being assembled
+uint8_t *FRAME;
+uint32_t FRAME_SIZE = 0;
+int FRAME_HAS_SLICE = 0;
+
+// Start of the last NAL unit in the FRAME (including the start code) and
+// whether its type was already checked
+uint32_t NAL_START = 0;
+int NAL_PENDING = 0;
+
+// The last SPS and PPS (prepended to the key frames without them)
+uint8_t HEAD[MAX_HEAD_SIZE];
+uint32_t HEAD_SIZE = 0;
+
+// Number of zero bytes before the current byte
+int ZEROS = 0;
+
+long long FRAMES = 0, DROPPED = 0;
+
+
+// Publish the frame and keep the SPS and PPS for the next key frames
+void publish(struct legoirc_frame_buf *buf, uint8_t *data, uint32_t size) {
+    uint32_t i, start = 0, first_slice = 0, flags = 0;
+    int zeros = 0, type, has_sps = 0;
+
+    // Walk through the NAL units of the frame
+    for (i=0; i+1<size; i++) {
+        if (data[i] == 0) {
+            zeros++;
+            continue;
+        }
+
+        if (data[i] == 1 && zeros >= 2) {
+            start = i - (zeros > 3 ? 3 : zeros);
+            type = data[i + 1] & 0x1f;
+
+            if (type == NAL_SPS) {
+                has_sps = 1;
+            } else if ((type == NAL_SLICE || type == NAL_IDR) && first_slice == 0) {
+                first_slice = start;
+            }
+
+            if (type == NAL_IDR)
+                flags |= LEGOIRC_FRAME_KEY;
+        }
+
+        zeros = 0;
+    }
+
+    // Remember the headers before the first slice
+    if (has_sps && first_slice > 0 && first_slice <= MAX_HEAD_SIZE) {
+        memcpy(HEAD, data, first_slice);
+        HEAD_SIZE = first_slice;
+    }
+
+    if (legoirc_frame_publish(buf, HEAD, (flags & LEGOIRC_FRAME_KEY) && ! has_sps ? HEAD_SIZE : 0,
+            data, size, flags) == -1) {
+        DROPPED++;
+        return;
+    }
+
+    FRAMES++;
+
+    // STDOUT is the video stream
+    if (DEBUG > 1)
+        fprintf(stderr, "D: Frame %lld: %u B%s\n", FRAMES, size, flags & LEGOIRC_FRAME_KEY ? " (key)" : "");
+}
+
+
+// Check whether the new NAL unit starts a new frame
+void check_nal(struct legoirc_frame_buf *buf) {
+    uint8_t *nal;
+    int type, new_frame = 0;
+
+    // Skip the start code
+    nal = FRAME + NAL_START;
+    while (*nal == 0)
+        nal++;
+    nal++;
+
+    // Need the NAL header and the first byte of the slice header
+    if (nal + 2 > FRAME + FRAME_SIZE)
+        return;
+
+    NAL_PENDING = 0;
+    type = nal[0] & 0x1f;
+
+    if (type == NAL_SLICE || type == NAL_IDR) {
+        // first_mb_in_slice == 0 (Exp-Golomb "1") is the first slice of a frame
+        new_frame = FRAME_HAS_SLICE && (nal[1] & 0x80);
+        FRAME_HAS_SLICE = 1;
+    } else if (type == NAL_AUD || type == NAL_SPS || type == NAL_PPS || type == NAL_SEI) {
+        new_frame = FRAME_HAS_SLICE;
+    }
+
+    if (! new_frame)
+        return;
+
+    publish(buf, FRAME, NAL_START);
+
+    // Move the new NAL unit to the beginning
+    memmove(FRAME, FRAME + NAL_START, FRAME_SIZE - NAL_START);
+    FRAME_SIZE -= NAL_START;
+    NAL_START = 0;
+    FRAME_HAS_SLICE = type == NAL_SLICE || type == NAL_IDR;
+}
+
+
+void parse(struct legoirc_frame_buf *buf, uint8_t *data, int size) {
+    int i;
+
+    for (i=0; i<size; i++) {
+        // Too big frame is dropped
+        if (FRAME_SIZE >= LEGOIRC_FRAME_MAX_SIZE) {
+            if (DEBUG > 0)
+                fputs("D: Dropping too big frame\n", stderr);
+
+            DROPPED++;
+            FRAME_SIZE = 0;
+            NAL_START = 0;
+            NAL_PENDING = 0;
+            FRAME_HAS_SLICE = 0;
+        }
+
+        FRAME[FRAME_SIZE++] = data[i];
+
+        if (NAL_PENDING)
+            check_nal(buf);
+
+        if (data[i] == 0) {
+            ZEROS++;
+            continue;
+        }
+
+        // Start code (00 00 01 or 00 00 00 01)
+        if (data[i] == 1 && ZEROS >= 2) {
+            if (NAL_PENDING)
+                check_nal(buf);
+
+            NAL_START = FRAME_SIZE - 1 - (ZEROS > 3 ? 3 : ZEROS);
+            NAL_PENDING = 1;
+        }
+
+        ZEROS = 0;
+    }
+}
+
+
+void usage(char *name) {
+    printf("Usage: %s [options]\n\n", name);
+    puts("Copies the H.264 stream from STDIN to STDOUT and publishes the latest");
+    puts("frame into the shared memory.\n");
+    puts("Options:");
+    puts(" -f STR  Frame buffer file (default: /dev/shm/legoirc-frame)");
+    puts(" -d NUM  Debug level [0-2] (default: 0)");
+    puts(" -h      Show this help message and exit");
+}
+
+
+int main(int argc, char *argv[]) {
+    struct legoirc_frame_buf *buf;
+    uint8_t data[BUFSIZE];
+    char *path = LEGOIRC_FRAME_PATH;
+    int c, n, written, w;
+
+    // Parse command line options
+    while ((c = getopt(argc, argv, "f:d:h")) != -1) {
+        switch (c) {
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+                break;
+            case 'f':
+                path = optarg;
+                break;
+            case 'd':
+                DEBUG = atoi(optarg);
+                break;
+            default:
+                abort();
+        }
+    }
+
+    if ((buf = legoirc_frame_create(path)) == NULL) {
+        perror("ERROR on creating frame buffer");
+        exit(EXIT_FAILURE);
+    }
+
+    if ((FRAME = malloc(LEGOIRC_FRAME_MAX_SIZE)) == NULL) {
+        perror("ERROR on malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    while ((n = read(STDIN_FILENO, data, sizeof data)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+
+            perror("ERROR reading stream");
+            exit(EXIT_FAILURE);
+        }
+
+        // Pass the stream further first to not to delay it
+        for (written = 0; written < n; written += w) {
+            if ((w = write(STDOUT_FILENO, data + written, n - written)) == -1) {
+                perror("ERROR writing stream");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        parse(buf, data, n);
+    }
+
+    // The last frame
+    if (FRAME_HAS_SLICE)
+        publish(buf, FRAME, FRAME_SIZE);
+
+    if (DEBUG > 0)
+        fprintf(stderr, "D: Published %lld frames, dropped %lld\n", FRAMES, DROPPED);
+
+    legoirc_frame_close(buf);
+    free(FRAME);
+
+    return EXIT_SUCCESS;
+}
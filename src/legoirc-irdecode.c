@@ -0,0 +1,206 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pfdecode.h"
+
+
+// Max number of the GPIO pins
+#define MAX_PINS 54
+
+// Max length of the trace line
+#define BUFSIZE 100
+
+
+// Debug variable
+int DEBUG = 0;
+
+// Statistics of a single pin
+struct pin_stats {
+    int used;
+    struct pf_decoder decoder;
+    unsigned long long first, last;
+    int frames;
+    int errors[PF_ERR_COUNT];
+    float mark_margin, bit_margin;
+    int repeats, gap_violations;
+    float gap_margin;
+    double dev_sum, dev_sq_sum;
+    long bits;
+};
+
+
+void add_frame(struct pin_stats *st, struct pf_frame *f) {
+    st->frames++;
+    st->errors[f->status]++;
+
+    if (DEBUG > 0) {
+        printf("%llu pin=%d %-13s nibbles=%x%x%x%x ch=%d rep=%d mark=%+.0f bit=%+.0f",
+            f->start, f->pin, pf_status_str(f->status), f->nibble[0], f->nibble[1],
+            f->nibble[2], f->nibble[3], f->channel, f->repeat, f->mark_margin, f->bit_margin);
+
+        if (f->repeat > 1)
+            printf(" gap=%+.0f", f->gap_margin);
+
+        printf("\n");
+    }
+
+    // Too early repetitions are rejected but still counted in the margin
+    if (f->repeat > 1 && (f->status == PF_OK || f->status == PF_ERR_GAP)) {
+        st->repeats++;
+
+        if (f->gap_margin < 0)
+            st->gap_violations++;
+        if (st->repeats == 1 || f->gap_margin < st->gap_margin)
+            st->gap_margin = f->gap_margin;
+    }
+
+    if (f->status != PF_OK)
+        return;
+
+    if (f->mark_margin < st->mark_margin)
+        st->mark_margin = f->mark_margin;
+    if (f->bit_margin < st->bit_margin)
+        st->bit_margin = f->bit_margin;
+
+    st->dev_sum += f->dev_sum;
+    st->dev_sq_sum += f->dev_sq_sum;
+    st->bits += f->bits;
+}
+
+
+void print_stats(int pin, struct pin_stats *st) {
+    double duration = (st->last - st->first) / 1e6;
+    double mean = st->bits ? st->dev_sum / st->bits : 0;
+    double jitter = st->bits ? sqrt(st->dev_sq_sum / st->bits - mean * mean) : 0;
+    int i;
+
+    printf("Pin %d:\n", pin);
+    printf("  Frames:          %d\n", st->frames);
+    printf("  Accepted:        %d (%.2f%%)\n", st->errors[PF_OK],
+        st->frames ? 100.0 * st->errors[PF_OK] / st->frames : 0);
+
+    for (i=1; i<PF_ERR_COUNT; i++) {
+        if (st->errors[i])
+            printf("  Rejected (%s): %d\n", pf_status_str(i), st->errors[i]);
+    }
+
+    if (st->errors[PF_OK] == 0)
+        return;
+
+    printf("  Throughput:      %.2f frames/s\n", duration > 0 ? st->errors[PF_OK] / duration : 0);
+    printf("  Pulse margin:    %.0f us\n", st->mark_margin);
+    printf("  Bit margin:      %.0f us\n", st->bit_margin);
+    printf("  Bit deviation:   %+.1f us (jitter %.1f us)\n", mean, jitter);
+
+    if (st->repeats)
+        printf("  Repeat margin:   %.0f us (%d of %d too early)\n",
+            st->gap_margin, st->gap_violations, st->repeats);
+}
+
+
+void usage(char *name) {
+    printf("Usage: %s [options]\n\n", name);
+    puts("Options:");
+    puts(" -f STR  GPIO trace file (default: STDIN)");
+    puts(" -g NUM  Decode only this GPIO");
+    puts(" -d NUM  Debug level [0-1] (default: 0)");
+    puts(" -h      Show this help message and exit");
+}
+
+
+int main(int argc, char *argv[]) {
+    struct pin_stats *stats;
+    struct pf_frame frame;
+    char line[BUFSIZE];
+    unsigned long long time, first = 0, last = 0;
+    FILE *trace = stdin;
+    int only_pin = -1;
+    int total_frames = 0, total_accepted = 0;
+    int pin, level, c, i;
+
+    // Parse command line options
+    while ((c = getopt(argc, argv, "f:g:d:h")) != -1) {
+        switch (c) {
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+                break;
+            case 'f':
+                if ((trace = fopen(optarg, "r")) == NULL) {
+                    perror("ERROR opening trace");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'g':
+                only_pin = atoi(optarg);
+                break;
+            case 'd':
+                DEBUG = atoi(optarg);
+                break;
+            default:
+                abort();
+        }
+    }
+
+    if ((stats = calloc(MAX_PINS, sizeof(struct pin_stats))) == NULL) {
+        perror("ERROR on calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    // Feed the decoders line by line
+    while (fgets(line, sizeof line, trace) != NULL) {
+        if (sscanf(line, "%llu %d %d", &time, &pin, &level) != 3 || pin < 0 || pin >= MAX_PINS) {
+            fprintf(stderr, "W: Ignoring invalid line: %s", line);
+            continue;
+        }
+
+        if (only_pin >= 0 && pin != only_pin)
+            continue;
+
+        if (! stats[pin].used) {
+            pf_decoder_init(&stats[pin].decoder, pin);
+            stats[pin].used = 1;
+            stats[pin].first = time;
+            stats[pin].mark_margin = 1e9;
+            stats[pin].bit_margin = 1e9;
+        }
+
+        stats[pin].last = time;
+
+        if (pf_decoder_edge(&stats[pin].decoder, time, level, &frame))
+            add_frame(&stats[pin], &frame);
+    }
+
+    // Report
+    for (i=0; i<MAX_PINS; i++) {
+        if (! stats[i].used)
+            continue;
+
+        if (pf_decoder_flush(&stats[i].decoder, &frame))
+            add_frame(&stats[i], &frame);
+
+        print_stats(i, &stats[i]);
+
+        total_frames += stats[i].frames;
+        total_accepted += stats[i].errors[PF_OK];
+
+        if (first == 0 || stats[i].first < first)
+            first = stats[i].first;
+        if (stats[i].last > last)
+            last = stats[i].last;
+    }
+
+    printf("Total: %d of %d frames accepted", total_accepted, total_frames);
+
+    if (last > first)
+        printf(" (%.2f frames/s)", total_accepted / ((last - first) / 1e6));
+
+    printf("\n");
+
+    free(stats);
+
+    return total_accepted == total_frames ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,372 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "legoirc-local.h"
+
+
+// Max number of the measured requests
+#define MAX_COUNT 100000
+
+// Max length of the reply
+#define BUFSIZE 256
+
+// Size of the block of the bulk stream
+#define BULK_SIZE 65536
+
+
+// Socket tuning of the control connection (the same as the legoirc-client)
+int SOCK_NODELAY = 1;
+int SOCK_PRIORITY = 6;
+int SOCK_DSCP = 46;
+
+// Number of the requests and the time between them (in microseconds)
+int COUNT = 600;
+int INTERVAL = 33000;
+
+// Run a bulk stream on the loopback in parallel (simulates the camera)
+int BULK = 0;
+
+// GPIO trace of the legoirc-server-sim (measures the time from the command to
+// the first IR edge instead of the time requests if set)
+char *TRACE = NULL;
+
+// UNIX socket of the local API (the commands are sent through the TCP if NULL)
+char *LOCAL_PATH = NULL;
+
+// Round-trip times of the requests or the IR latencies (in microseconds)
+double RTT[MAX_COUNT];
+
+// Times when the commands were sent (in microseconds)
+double SENT[MAX_COUNT];
+
+
+double now_us() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+int cmp_double(const void *a, const void *b) {
+    double x = *(double *) a, y = *(double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+// Send the data as fast as possible
+void *bulk_send(void *arg) {
+    static char buf[BULK_SIZE];
+    int sock = *(int *) arg;
+
+    while (write(sock, buf, sizeof buf) > 0);
+
+    return NULL;
+}
+
+
+// Read the data slower than they are sent so the send queue is always full
+void *bulk_recv(void *arg) {
+    static char buf[BULK_SIZE];
+    int sock = *(int *) arg;
+
+    while (read(sock, buf, sizeof buf) > 0)
+        usleep(200);
+
+    return NULL;
+}
+
+
+// Start the bulk stream between two loopback sockets
+void start_bulk() {
+    static int socks[2];
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    pthread_t thread;
+    int sock;
+
+    bzero((char *) &addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+            bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+            getsockname(sock, (struct sockaddr *) &addr, &len) == -1 ||
+            listen(sock, 1) == -1) {
+        perror("ERROR opening bulk socket");
+        exit(EXIT_FAILURE);
+    }
+
+    if ((socks[0] = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+            connect(socks[0], (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+            (socks[1] = accept(sock, NULL, NULL)) == -1) {
+        perror("ERROR connecting bulk socket");
+        exit(EXIT_FAILURE);
+    }
+
+    close(sock);
+
+    if (pthread_create(&thread, NULL, bulk_send, &socks[0]) != 0 ||
+            pthread_create(&thread, NULL, bulk_recv, &socks[1]) != 0) {
+        fputs("ERROR: Can't start bulk stream\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+int connect_server(char *host, char *port) {
+    struct addrinfo hints, *servinfo, *p;
+    int sock = -1, tos = SOCK_DSCP << 2, rv;
+
+    bzero((char *) &hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ((rv = getaddrinfo(host, port, &hints, &servinfo)) != 0) {
+        fprintf(stderr, "ERROR on getaddrinfo: %s\n", gai_strerror(rv));
+        exit(EXIT_FAILURE);
+    }
+
+    for (p = servinfo; p != NULL; p = p->ai_next) {
+        if ((sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
+            continue;
+
+        if (connect(sock, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+
+        close(sock);
+        sock = -1;
+    }
+
+    freeaddrinfo(servinfo);
+
+    if (sock == -1) {
+        perror("ERROR connecting");
+        exit(EXIT_FAILURE);
+    }
+
+    if (SOCK_NODELAY)
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &SOCK_NODELAY, sizeof(SOCK_NODELAY));
+
+    if (SOCK_PRIORITY > 0)
+        setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &SOCK_PRIORITY, sizeof(SOCK_PRIORITY));
+
+    if (SOCK_DSCP > 0)
+        setsockopt(sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+
+    return sock;
+}
+
+
+// Send the command (forward and backward in turns so each one changes the
+// state of the transmitter)
+void send_key(int sock, struct legoirc_local *local, int i) {
+    char buf[2] = {i % 2 ? '2' : '8', '\n'};
+
+    SENT[i] = now_us();
+
+    if (local != NULL) {
+        if (legoirc_local_send(local, 0, buf[0]) == -1) {
+            perror("ERROR on legoirc_local_send");
+            exit(EXIT_FAILURE);
+        }
+    } else if (write(sock, buf, sizeof buf) == -1) {
+        perror("ERROR writing to socket");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+// Match each command with the first IR edge which followed it in the trace.
+// Returns the number of the matched commands.
+int read_edges(char *path) {
+    FILE *f;
+    unsigned long long time;
+    int pin, level, i = 0, n = 0;
+
+    if ((f = fopen(path, "r")) == NULL) {
+        perror("ERROR opening trace");
+        exit(EXIT_FAILURE);
+    }
+
+    while (i < COUNT && fscanf(f, "%llu %d %d", &time, &pin, &level) == 3) {
+        if (level == 0 || time < SENT[i])
+            continue;
+
+        RTT[n++] = time - SENT[i];
+
+        // Commands sent before the edge didn't get their own frame
+        while (i < COUNT && SENT[i] <= time)
+            i++;
+    }
+
+    fclose(f);
+
+    return n;
+}
+
+
+void usage(char *name) {
+    printf("Usage: %s [options]\n\n", name);
+    puts("Measures the round-trip time of the time requests (\"T<id>\") answered by");
+    puts("the legoirc-server through the control connection or, with the -e option,");
+    puts("the time from the command to the first IR edge of the legoirc-server-sim.\n");
+    puts("Options:");
+    puts(" -s STR  Server IP or host name (default: 127.0.0.1)");
+    puts(" -p NUM  Server port number (default: 5001)");
+    puts(" -c NUM  Number of the requests (default: 600)");
+    puts(" -i NUM  Time between the requests in us (default: 33000)");
+    puts(" -b      Run a bulk stream on the loopback at the same time");
+    puts(" -e STR  GPIO trace of the legoirc-server-sim (LEGOIRC_GPIO_TRACE)");
+    puts(" -L STR  Send the commands through the local API socket (with -e)");
+    puts(" -n      Don't disable the Nagle's algorithm (TCP_NODELAY)");
+    puts(" -P NUM  Socket priority, 0 to disable (default: 6)");
+    puts(" -T NUM  DSCP value of the control traffic, 0 to disable (default: 46)");
+    puts(" -h      Show this help message and exit");
+}
+
+
+int main(int argc, char *argv[]) {
+    char *host = "127.0.0.1", *port = "5001";
+    char buf[BUFSIZE];
+    double start;
+    int sock = -1, c, i, n, len;
+    struct legoirc_local local;
+
+    // Parse command line options
+    while ((c = getopt(argc, argv, "s:p:c:i:be:L:nP:T:h")) != -1) {
+        switch (c) {
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+                break;
+            case 's':
+                host = optarg;
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            case 'c':
+                COUNT = atoi(optarg);
+                break;
+            case 'i':
+                INTERVAL = atoi(optarg);
+                break;
+            case 'b':
+                BULK = 1;
+                break;
+            case 'e':
+                TRACE = optarg;
+                break;
+            case 'L':
+                LOCAL_PATH = optarg;
+                break;
+            case 'n':
+                SOCK_NODELAY = 0;
+                break;
+            case 'P':
+                SOCK_PRIORITY = atoi(optarg);
+                break;
+            case 'T':
+                SOCK_DSCP = atoi(optarg);
+                break;
+            default:
+                abort();
+        }
+    }
+
+    if (COUNT < 1 || COUNT > MAX_COUNT) {
+        fprintf(stderr, "ERROR: Invalid count: %d\n", COUNT);
+        exit(EXIT_FAILURE);
+    }
+
+    // The local API has no time requests
+    if (LOCAL_PATH != NULL && TRACE == NULL) {
+        fputs("ERROR: The -L option requires the -e option\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    if (LOCAL_PATH != NULL && legoirc_local_open(&local, LOCAL_PATH) == -1) {
+        perror("ERROR on legoirc_local_open");
+        exit(EXIT_FAILURE);
+    }
+
+    if (LOCAL_PATH == NULL)
+        sock = connect_server(host, port);
+
+    if (BULK)
+        start_bulk();
+
+    if (TRACE != NULL) {
+        srand(getpid());
+
+        for (i=0; i<COUNT; i++) {
+            send_key(sock, LOCAL_PATH != NULL ? &local : NULL, i);
+
+            // Random delay so the commands don't keep the same phase with
+            // the loop of the transmitter
+            usleep(INTERVAL + rand() % (INTERVAL / 10 + 1));
+        }
+
+        // Let the server write out the last frame
+        sleep(1);
+
+        n = read_edges(TRACE);
+
+        if (n == 0) {
+            fputs("ERROR: No IR edge found in the trace\n", stderr);
+            exit(EXIT_FAILURE);
+        }
+
+        qsort(RTT, n, sizeof(double), cmp_double);
+
+        printf("I: %d of %d commands: first IR edge p50 %.0f us, p90 %.0f us, max %.0f us\n", n, COUNT,
+            RTT[n / 2], RTT[n * 9 / 10], RTT[n - 1]);
+
+        return EXIT_SUCCESS;
+    }
+
+    for (i=0; i<COUNT; i++) {
+        n = snprintf(buf, sizeof buf, "T%d\n", i);
+        start = now_us();
+
+        if (write(sock, buf, n) == -1) {
+            perror("ERROR writing to socket");
+            exit(EXIT_FAILURE);
+        }
+
+        // The reply is a single short line
+        for (len = 0; len == 0 || buf[len - 1] != '\n'; len += n) {
+            if ((n = read(sock, buf + len, sizeof(buf) - len)) <= 0) {
+                perror("ERROR reading from socket");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        RTT[i] = now_us() - start;
+
+        usleep(INTERVAL);
+    }
+
+    close(sock);
+
+    qsort(RTT, COUNT, sizeof(double), cmp_double);
+
+    printf("I: %d requests: rtt p50 %.0f us, p90 %.0f us, p99 %.0f us, max %.0f us\n", COUNT,
+        RTT[COUNT / 2], RTT[COUNT * 9 / 10], RTT[COUNT * 99 / 100], RTT[COUNT - 1]);
+
+    return EXIT_SUCCESS;
+}
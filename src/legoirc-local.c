@@ -0,0 +1,302 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "legoirc-local.h"
+
+
+// Number of the passed file descriptors (shared memory and the eventfds)
+#define PASSED_FDS (1 + LEGOIRC_LOCAL_CHANNELS)
+
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static struct legoirc_slot *get_slot(struct legoirc_ring *ring, uint64_t pos) {
+    return &ring->slots[pos & (LEGOIRC_LOCAL_RING_SIZE - 1)];
+}
+
+
+int legoirc_local_open(struct legoirc_local *l, const char *path) {
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char buf[CMSG_SPACE(PASSED_FDS * sizeof(int))];
+    char c;
+    int fds[PASSED_FDS];
+    int sock, i;
+
+    memset(l, 0, sizeof *l);
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+        return -1;
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if (connect(sock, (struct sockaddr *) &addr, sizeof addr) == -1) {
+        close(sock);
+        return -1;
+    }
+
+    // Receive the file descriptors
+    memset(&msg, 0, sizeof msg);
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = buf;
+    msg.msg_controllen = sizeof buf;
+
+    if (recvmsg(sock, &msg, 0) != 1) {
+        close(sock);
+        return -1;
+    }
+
+    close(sock);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(PASSED_FDS * sizeof(int))) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof fds);
+    l->shm_fd = fds[0];
+
+    for (i=0; i<LEGOIRC_LOCAL_CHANNELS; i++)
+        l->event_fds[i] = fds[i + 1];
+
+    l->shm = mmap(NULL, sizeof(struct legoirc_shm), PROT_READ | PROT_WRITE, MAP_SHARED, l->shm_fd, 0);
+    if (l->shm == MAP_FAILED) {
+        l->shm = NULL;
+        legoirc_local_close(l);
+        return -1;
+    }
+
+    if (l->shm->magic != LEGOIRC_LOCAL_MAGIC || l->shm->version != LEGOIRC_LOCAL_VERSION) {
+        legoirc_local_close(l);
+        errno = EPROTO;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int legoirc_local_send(struct legoirc_local *l, int channel, int keycode) {
+    struct legoirc_ring *ring;
+    struct legoirc_slot *slot;
+    uint64_t pos, seq;
+    uint64_t one = 1;
+
+    if (channel == 0)
+        channel = l->shm->channel;
+
+    if (channel < 1 || channel > LEGOIRC_LOCAL_CHANNELS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Nobody would read the ring
+    if (! l->shm->served[channel - 1]) {
+        errno = ENXIO;
+        return -1;
+    }
+
+    ring = &l->shm->rings[channel - 1];
+
+    pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+    // Reserve a free slot
+    while (1) {
+        slot = get_slot(ring, pos);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, 0,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if ((int64_t) (seq - pos) < 0) {
+            // The transmitter didn't read the slot yet
+            errno = EAGAIN;
+            return -1;
+        } else {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->cmd.channel = channel;
+    slot->cmd.keycode = keycode;
+    slot->cmd.reserved = 0;
+    slot->cmd.seq = l->seq++;
+    slot->cmd.time = now_ns();
+
+    // Publish the command
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    // Wake up the transmitter only if it sleeps
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED)) {
+        if (write(l->event_fds[channel - 1], &one, sizeof one) == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+void legoirc_local_close(struct legoirc_local *l) {
+    int i;
+
+    if (l->shm != NULL)
+        munmap(l->shm, sizeof(struct legoirc_shm));
+
+    close(l->shm_fd);
+
+    for (i=0; i<LEGOIRC_LOCAL_CHANNELS; i++)
+        close(l->event_fds[i]);
+
+    l->shm = NULL;
+}
+
+
+int legoirc_local_create(struct legoirc_local *l) {
+    char name[32];
+    uint64_t i;
+    int ch;
+
+    memset(l, 0, sizeof *l);
+
+    // Anonymous shared memory (accessible only through the passed descriptor)
+    snprintf(name, sizeof name, "/legoirc-local-%d", getpid());
+
+    if ((l->shm_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) == -1)
+        return -1;
+
+    shm_unlink(name);
+
+    if (ftruncate(l->shm_fd, sizeof(struct legoirc_shm)) == -1) {
+        close(l->shm_fd);
+        return -1;
+    }
+
+    l->shm = mmap(NULL, sizeof(struct legoirc_shm), PROT_READ | PROT_WRITE, MAP_SHARED, l->shm_fd, 0);
+    if (l->shm == MAP_FAILED) {
+        close(l->shm_fd);
+        return -1;
+    }
+
+    for (ch=0; ch<LEGOIRC_LOCAL_CHANNELS; ch++) {
+        if ((l->event_fds[ch] = eventfd(0, EFD_NONBLOCK)) == -1) {
+            while (ch--)
+                close(l->event_fds[ch]);
+
+            munmap(l->shm, sizeof(struct legoirc_shm));
+            close(l->shm_fd);
+            return -1;
+        }
+
+        for (i=0; i<LEGOIRC_LOCAL_RING_SIZE; i++)
+            l->shm->rings[ch].slots[i].seq = i;
+    }
+
+    l->shm->version = LEGOIRC_LOCAL_VERSION;
+    __atomic_store_n(&l->shm->magic, LEGOIRC_LOCAL_MAGIC, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+
+int legoirc_local_accept(struct legoirc_local *l, int sock) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char buf[CMSG_SPACE(PASSED_FDS * sizeof(int))];
+    char c = 0;
+    int fds[PASSED_FDS];
+    int i;
+
+    fds[0] = l->shm_fd;
+
+    for (i=0; i<LEGOIRC_LOCAL_CHANNELS; i++)
+        fds[i + 1] = l->event_fds[i];
+
+    memset(&msg, 0, sizeof msg);
+    memset(buf, 0, sizeof buf);
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = buf;
+    msg.msg_controllen = sizeof buf;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof fds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+
+    return sendmsg(sock, &msg, 0) == 1 ? 0 : -1;
+}
+
+
+int legoirc_local_recv(struct legoirc_local *l, int channel, struct legoirc_cmd *cmd) {
+    struct legoirc_ring *ring = &l->shm->rings[channel - 1];
+    struct legoirc_slot *slot = get_slot(ring, ring->tail);
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring->tail + 1)
+        return 0;
+
+    memcpy(cmd, &slot->cmd, sizeof *cmd);
+
+    // Release the slot for the next round
+    __atomic_store_n(&slot->seq, ring->tail + LEGOIRC_LOCAL_RING_SIZE, __ATOMIC_RELEASE);
+    ring->tail++;
+
+    return 1;
+}
+
+
+int legoirc_local_sleep(struct legoirc_local *l, int channel) {
+    struct legoirc_ring *ring = &l->shm->rings[channel - 1];
+
+    __atomic_store_n(&ring->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    // Command could be pushed before the flag was set
+    if (__atomic_load_n(&get_slot(ring, ring->tail)->seq, __ATOMIC_ACQUIRE) == ring->tail + 1) {
+        __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+void legoirc_local_wake(struct legoirc_local *l, int channel) {
+    uint64_t value;
+
+    __atomic_store_n(&l->shm->rings[channel - 1].waiting, 0, __ATOMIC_RELAXED);
+
+    // Reset the counter (non-blocking)
+    if (read(l->event_fds[channel - 1], &value, sizeof value) == -1 && errno != EAGAIN)
+        perror("ERROR reading eventfd");
+}
@@ -0,0 +1,125 @@
+// Local command API of the legoirc-server
+//
+// Processes running on the same Raspberry Pi (e.g. a line follower reading
+// the camera) can send the commands directly into the IR transmitters without
+// the TCP connection and the text protocol. The commands are pushed into the
+// ring buffer of their channel in the shared memory and the transmitter
+// serving the channel reads the ring itself (it's woken up through the
+// eventfd of the channel). The file descriptors are passed to the process
+// only once, when it connects to the UNIX socket of the server (see the -L
+// option of the legoirc-server):
+//
+//   struct legoirc_local l;
+//
+//   if (legoirc_local_open(&l, LEGOIRC_LOCAL_PATH) == -1)
+//       ...
+//
+//   legoirc_local_send(&l, 1, '8');
+//   ...
+//   legoirc_local_close(&l);
+//
+// Any number of processes can send the commands at the same time. If the ring
+// is full, legoirc_local_send() fails with EAGAIN, if the channel isn't served
+// by any transmitter, it fails with ENXIO.
+
+#ifndef LEGOIRC_LOCAL_H
+#define LEGOIRC_LOCAL_H
+
+#include <stdint.h>
+
+
+// Default path of the UNIX socket
+#define LEGOIRC_LOCAL_PATH "/run/legoirc-server.sock"
+
+// Number of the IR channels (one ring per channel)
+#define LEGOIRC_LOCAL_CHANNELS 4
+
+// Number of the slots in the ring (must be power of 2)
+#define LEGOIRC_LOCAL_RING_SIZE 256
+
+// Identification of the shared memory layout
+#define LEGOIRC_LOCAL_MAGIC 0x4c474952
+#define LEGOIRC_LOCAL_VERSION 2
+
+
+// Binary command
+struct legoirc_cmd {
+    // IR channel (1-4) or 0 for the default channel of the server
+    uint8_t channel;
+    // Same keycode as in the text protocol (e.g. '8' for forward)
+    uint8_t keycode;
+    uint16_t reserved;
+    // Sequence number of the command of the sender
+    uint32_t seq;
+    // Time when the command was sent (CLOCK_MONOTONIC in nanoseconds)
+    uint64_t time;
+};
+
+struct legoirc_slot {
+    uint64_t seq;
+    struct legoirc_cmd cmd;
+};
+
+// Ring of one channel (multiple producers, single consumer)
+struct legoirc_ring {
+    // Next position to write (shared by the producers)
+    uint64_t head __attribute__((aligned(64)));
+    // Next position to read (the transmitter only)
+    uint64_t tail __attribute__((aligned(64)));
+    // Set when the transmitter waits for the eventfd
+    uint32_t waiting __attribute__((aligned(64)));
+    struct legoirc_slot slots[LEGOIRC_LOCAL_RING_SIZE] __attribute__((aligned(64)));
+};
+
+// Shared memory of the local API
+struct legoirc_shm {
+    uint32_t magic;
+    uint32_t version;
+    // Channel of the commands sent to the channel 0 (set by the server)
+    uint32_t channel;
+    // Channels served by a transmitter (set by the server)
+    uint8_t served[LEGOIRC_LOCAL_CHANNELS];
+    struct legoirc_ring rings[LEGOIRC_LOCAL_CHANNELS];
+};
+
+// Handle of the local API
+struct legoirc_local {
+    struct legoirc_shm *shm;
+    int shm_fd;
+    // Eventfd of each channel
+    int event_fds[LEGOIRC_LOCAL_CHANNELS];
+    uint32_t seq;
+};
+
+
+// Connect to the server and map the ring. Returns 0 on success, -1 on error.
+int legoirc_local_open(struct legoirc_local *l, const char *path);
+
+// Push the command into the ring. Returns 0 on success, -1 on error.
+int legoirc_local_send(struct legoirc_local *l, int channel, int keycode);
+
+// Unmap the ring
+void legoirc_local_close(struct legoirc_local *l);
+
+
+// Server side: create the shared memory with the rings and the eventfds. The
+// server sets the channel and the served channels before it accepts any
+// process.
+int legoirc_local_create(struct legoirc_local *l);
+
+// Server side: pass the file descriptors to the connected process
+int legoirc_local_accept(struct legoirc_local *l, int sock);
+
+// Server side: pop the next command from the ring of the channel. Returns 1
+// if there was a command, 0 if the ring is empty.
+int legoirc_local_recv(struct legoirc_local *l, int channel, struct legoirc_cmd *cmd);
+
+// Server side: announce that the transmitter is going to wait for the eventfd
+// of the channel. Returns 1 if the ring isn't empty (the transmitter shouldn't
+// wait), otherwise 0.
+int legoirc_local_sleep(struct legoirc_local *l, int channel);
+
+// Server side: clear the eventfd of the channel after the transmitter woke up
+void legoirc_local_wake(struct legoirc_local *l, int channel);
+
+#endif
@@ -1,15 +1,32 @@
+#define _GNU_SOURCE
+
+#ifdef GPIO_SIM
+#include "gpio-sim.h"
+#else
 #include <bcm2835.h>
+#endif
+#include <poll.h>
+#include <sched.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
 #include <sys/shm.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/un.h>
+
+#include "legoirc-local.h"
 
 
 // Max length of queue for the incomming connections
@@ -41,13 +58,52 @@
 // Waiting time in the send command loop
 #define CMD_LOOP_WAIT 1e5
 
+// Number of the IR channels
+#define CHANNELS 4
+
+// Max number of the IR transmitters (each needs at least one channel)
+#define MAX_TRANSMITTERS CHANNELS
+
+// First file descriptor passed by the systemd
+#define LISTEN_FDS_START 3
+
+// How long before its deadline the transmitter starts waiting for the
+// scheduled command and how long after the deadline the client gets the reply
+// at the latest (in nanoseconds)
+#define SCHEDULE_TIMEOUT 1000000000ULL
+
+// Max delay of the first message of the scheduled command after its deadline
+// (in nanoseconds), the later commands are rejected
+#define SCHEDULE_LATE 1000000ULL
+
+// The transmitter waits for the scheduled command in poll() until this time
+// before the first message and then in the delay (in microseconds)
+#define SCHEDULE_POLL_MIN 2000
+
+// Max number of the client connections taken over from the previous run
+#define MAX_CLIENTS 64
+
+// Max length of the message for the systemd
+#define NOTIFY_SIZE 256
+
+// Name prefix of the client connections in the fd store of the systemd
+#define CLIENT_FDNAME "client-"
+
 // Debug variable
 int DEBUG = 0;
 
+// Socket tuning of the control connections
+int SOCK_IPV6 = 0;
+int SOCK_NODELAY = 1;
+int SOCK_QUICKACK = 1;
+int SOCK_PRIORITY = 6;
+int SOCK_DSCP = 46;
+int SOCK_BUSY_POLL = 0;
+
 // Pin to which the data cable is connected (GPIO24)
 int GPIO_PIN = RPI_BPLUS_GPIO_J8_18;
 
-// IR channel
+// IR channel (default channel of the commands without the channel prefix)
 int CHANNEL = 1;
 
 // 0xf vector needed for the XOR checksum
@@ -71,6 +127,30 @@ int MODE4_DIR_RIGHT[4]    = {1, 0, 0, 1};
 // IR mode to be used
 int MODE = 4;
 
+// IR transmitter (GPIO pin with its own set of channels and mode)
+struct transmitter {
+    int pin;
+    int channels[CHANNELS];
+    int mode;
+    // Eventfd waking up the worker when a command for its channel is stored
+    int wake_fd;
+};
+
+// Path of the UNIX socket of the local API (disabled if NULL)
+char *LOCAL_PATH = NULL;
+
+// Rings of the local API (shared by the transmitters and the local processes)
+struct legoirc_local LOCAL;
+
+// Transmitters defined by the -x option
+struct transmitter TRANSMITTERS[MAX_TRANSMITTERS];
+int TRANSMITTERS_NUM = 0;
+
+// Client connections taken over from the previous run (-1 once handed over)
+int CLIENTS[MAX_CLIENTS];
+char *CLIENT_NAMES[MAX_CLIENTS];
+int CLIENTS_NUM = 0;
+
 // Variables initialized in the init() function
 float PULSE_LEN, LOW_BIT_WAIT, HIGH_BIT_WAIT, START_BIT_WAIT, STOP_BIT_WAIT;
 float MAX_MSG_LEN, CHANNEL_WAIT_1, CHANNEL_WAIT_2_3, CHANNEL_WAIT_4_5, MSG_FREQ;
@@ -82,8 +162,27 @@ int shm_id;
 struct record {
     char msg[SHM_MSG_SIZE];
     struct timeval time;
+    // Deadline of the scheduled command (CLOCK_MONOTONIC in nanoseconds, 0 if
+    // the command should be sent immediately)
+    unsigned long long deadline;
+    // Deadline of the last sent scheduled command and when its first message
+    // was sent
+    unsigned long long done;
+    unsigned long long sent;
 };
 
+// Last command of each channel in the shared memory
+struct record *shm_data;
+
+// Transmitter of the worker process and the deadlines of the scheduled
+// commands it's sending (see run_transmitter())
+struct transmitter *TX = NULL;
+unsigned long long SENDING[CHANNELS];
+
+// Deadlines of the scheduled commands of the client connection waiting for
+// the reply (0 if there is none, see schedule_cmd())
+unsigned long long SCHEDULED[CHANNELS];
+
 
 void init() {
     // IR frequency (converted to microseconds)
@@ -111,6 +210,32 @@ void init() {
 }
 
 
+unsigned long long now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Check whether a scheduled command waits for the transmitter
+int scheduled_pending() {
+    int ch;
+
+    if (TX == NULL)
+        return 0;
+
+    for (ch=0; ch<CHANNELS; ch++) {
+        if (TX->channels[ch] && shm_data[ch].deadline != 0 && shm_data[ch].deadline != SENDING[ch] &&
+                shm_data[ch].deadline != shm_data[ch].done)
+            return 1;
+    }
+
+    return 0;
+}
+
+
 float get_time_diff(struct timeval *from, struct timeval *to) {
     return (to->tv_sec - from->tv_sec) * 1e6 + (to->tv_usec - from->tv_usec);
 }
@@ -183,21 +308,21 @@ void send_stop_bit() {
 
 void send_msg(int *data, int keycode) {
     int n, i;
-    struct record *shm_data;
 
     // Each message must be sent 5 times
     for (n=0; n<5; n++) {
-        // Read the current direction from the shared memory
-        shm_data = shmat(shm_id, (void *) 0, 0);
-        if (shm_data == (struct record *) -1) {
-            perror("ERROR on shmat");
-            exit(EXIT_FAILURE);
+        // Break the loop if the direction of the channel has changed
+        if (keycode != shm_data[CHANNEL - 1].msg[0]) {
+            if (DEBUG > 1)
+                puts("D: Breaking the send_msg loop because of a new command.");
+
+            break;
         }
 
-        // Break the loop if the direction has changed
-        if (keycode != shm_data->msg[0]) {
+        // The scheduled command must not wait for the repetitions
+        if (scheduled_pending()) {
             if (DEBUG > 1)
-                puts("D: Breaking the send_msg loop because of a new command.");
+                puts("D: Breaking the send_msg loop because of a scheduled command.");
 
             break;
         }
@@ -220,6 +345,12 @@ void send_msg(int *data, int keycode) {
             bcm2835_delayMicroseconds(CHANNEL_WAIT_4_5);
         }
 
+        // Let the client know when the scheduled command was sent
+        if (n == 0 && SENDING[CHANNEL - 1] != 0) {
+            shm_data[CHANNEL - 1].sent = now_ns();
+            __atomic_store_n(&shm_data[CHANNEL - 1].done, SENDING[CHANNEL - 1], __ATOMIC_RELEASE);
+        }
+
         // Send the message (max 16ms long)
         send_start_bit();
 
@@ -280,6 +411,10 @@ int proto_combo_pwm_mode(int keycode) {
     int recognized_direction = 0;
     int i;
 
+    // Set the channel (Toggle, Escape, Channel, Channel)
+    NIBBLE1[2] = ((CHANNEL - 1) >> 1) & 1;
+    NIBBLE1[3] = (CHANNEL - 1) & 1;
+
     // Reset directions
     memcpy(&NIBBLE2, &MODE4_DIR_NULL, sizeof NIBBLE2);
     memcpy(&NIBBLE3, &MODE4_DIR_NULL, sizeof NIBBLE3);
@@ -343,6 +478,40 @@ int proto_combo_pwm_mode(int keycode) {
 }
 
 
+// Apply the low-latency options to the socket (failures are not fatal)
+void set_sock_opts(int sock, int family) {
+    int tos = SOCK_DSCP << 2;
+
+    // Send the short command messages immediately (disable Nagle)
+    if (SOCK_NODELAY && setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &SOCK_NODELAY, sizeof(SOCK_NODELAY)) == -1)
+        perror("WARNING on setsockopt(TCP_NODELAY)");
+
+    // Acknowledge immediately instead of waiting for the delayed ACK timer
+    if (SOCK_QUICKACK && setsockopt(sock, IPPROTO_TCP, TCP_QUICKACK, &SOCK_QUICKACK, sizeof(SOCK_QUICKACK)) == -1)
+        perror("WARNING on setsockopt(TCP_QUICKACK)");
+
+    // Prioritize the control traffic over the camera stream on the host
+    if (SOCK_PRIORITY > 0 && setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &SOCK_PRIORITY, sizeof(SOCK_PRIORITY)) == -1)
+        perror("WARNING on setsockopt(SO_PRIORITY)");
+
+    // Mark the control traffic for the network (DSCP in the upper 6 bits)
+    if (SOCK_DSCP > 0) {
+        if (family == AF_INET6 && setsockopt(sock, IPPROTO_IPV6, IPV6_TCLASS, &tos, sizeof(tos)) == -1)
+            perror("WARNING on setsockopt(IPV6_TCLASS)");
+
+        // Also applies to the IPv4-mapped connections of a dual-stack socket
+        if (setsockopt(sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) == -1 && family == AF_INET)
+            perror("WARNING on setsockopt(IP_TOS)");
+    }
+
+#ifdef SO_BUSY_POLL
+    // Busy poll the device queue when reading from the socket
+    if (SOCK_BUSY_POLL > 0 && setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &SOCK_BUSY_POLL, sizeof(SOCK_BUSY_POLL)) == -1)
+        perror("WARNING on setsockopt(SO_BUSY_POLL)");
+#endif
+}
+
+
 int socket_readline(int sock, char **line) {
     int buf_size = BUFSIZE;
     int bytesloaded = 0;
@@ -362,8 +531,8 @@ int socket_readline(int sock, char **line) {
             return -1;
         }
 
-        // Break at the end of the line
-        if (c == '\n') {
+        // Break at the end of the line or when the connection was closed
+        if (n == 0 || c == '\n') {
             buffer[bytesloaded] = '\0';
             break;
         }
@@ -399,17 +568,171 @@ int socket_readline(int sock, char **line) {
 }
 
 
+// Get the transmitter driving the channel (NULL if there is none)
+struct transmitter *channel_transmitter(int channel) {
+    int i;
+
+    for (i=0; i<TRANSMITTERS_NUM; i++) {
+        if (TRANSMITTERS[i].channels[channel - 1])
+            return &TRANSMITTERS[i];
+    }
+
+    return NULL;
+}
+
+
+// Store the command into the record of the channel (deadline is 0 for the
+// commands which should be sent immediately)
+void store_cmd(int channel, char *msg, unsigned long long deadline) {
+    struct transmitter *tx = channel_transmitter(channel);
+
+    if (DEBUG > 1)
+        printf("D: Command >%s< for the channel %d\n", msg, channel);
+
+    if (DEBUG > 0 && tx == NULL)
+        printf("D: Channel %d is not served by any transmitter\n", channel);
+
+    strncpy(shm_data[channel - 1].msg, msg, SHM_MSG_SIZE);
+    shm_data[channel - 1].deadline = deadline;
+    gettimeofday(&shm_data[channel - 1].time, NULL);
+
+    // Don't let the transmitter finish its idle wait
+    if (tx != NULL && eventfd_write(tx->wake_fd, 1) == -1)
+        perror("WARNING on waking transmitter");
+}
+
+
+// Store the command into the record of the channel given by the optional
+// "<channel>:" prefix of the line (e.g. "2:8"). Returns the channel.
+int route_cmd(char *line, unsigned long long deadline) {
+    int channel = CHANNEL;
+
+    if (line[0] >= '1' && line[0] <= '0' + CHANNELS && line[1] == ':') {
+        channel = line[0] - '0';
+        line += 2;
+    }
+
+    store_cmd(channel, line, deadline);
+
+    return channel;
+}
+
+
+// Reply to the time request ("T<id>") with the CLOCK_MONOTONIC time of the
+// server in nanoseconds (used by the legoirc-fleet to estimate the offset)
+void reply_time(int sock, char *line) {
+    char buf[BUFSIZE];
+    int n;
+
+    n = snprintf(buf, sizeof buf, "%.32s %llu\n", line, now_ns());
+
+    if (write(sock, buf, n) == -1)
+        perror("ERROR writing to socket");
+}
+
+
+// Reply to the scheduled commands which were sent by the transmitter ("@<deadline>
+// <sent>" with the time when the first message was sent, 0 if the command was
+// replaced by another one or not sent in time). Returns the poll() timeout (in
+// milliseconds) of the next check, -1 if no command waits for the reply.
+int check_scheduled(int sock) {
+    unsigned long long deadline, now, sent;
+    char buf[BUFSIZE];
+    int ch, n, timeout = -1;
+
+    for (ch=0; ch<CHANNELS; ch++) {
+        if ((deadline = SCHEDULED[ch]) == 0)
+            continue;
+
+        now = now_ns();
+
+        if (__atomic_load_n(&shm_data[ch].done, __ATOMIC_ACQUIRE) == deadline) {
+            sent = shm_data[ch].sent;
+        } else if (shm_data[ch].deadline != deadline || now >= deadline + SCHEDULE_TIMEOUT) {
+            sent = 0;
+        } else {
+            // Sleep until the deadline and then check often
+            n = now < deadline ? (deadline - now) / 1000000 + 1 : 1;
+
+            if (timeout == -1 || n < timeout)
+                timeout = n;
+
+            continue;
+        }
+
+        if (DEBUG > 0 && sent == 0) {
+            printf("D: Scheduled command for the channel %d was not sent\n", ch + 1);
+        } else if (DEBUG > 0) {
+            printf("D: Scheduled command for the channel %d sent %lld ns after the deadline\n", ch + 1,
+                (long long) (sent - deadline));
+        }
+
+        n = snprintf(buf, sizeof buf, "@%llu %llu\n", deadline, sent);
+
+        if (write(sock, buf, n) == -1)
+            perror("ERROR writing to socket");
+
+        SCHEDULED[ch] = 0;
+    }
+
+    return timeout;
+}
+
+
+// Store the command which must be sent at the deadline ("@<deadline> <cmd>",
+// the deadline is CLOCK_MONOTONIC time of the server in nanoseconds). The
+// reply is sent later by check_scheduled() so the following commands of the
+// client don't wait for it.
+void schedule_cmd(int sock, char *line) {
+    unsigned long long deadline;
+    char *cmd;
+    int channel;
+
+    deadline = strtoull(line + 1, &cmd, 10);
+
+    if (deadline == 0 || *cmd != ' ') {
+        if (DEBUG > 0)
+            printf("D: Invalid scheduled command: >%s<\n", line);
+
+        return;
+    }
+
+    channel = route_cmd(cmd + 1, deadline);
+
+    // The previous scheduled command of the channel was replaced
+    check_scheduled(sock);
+
+    SCHEDULED[channel - 1] = deadline;
+}
+
+
 // Read messages from the client
-void read_client_msgs(int sock, struct record *shm_data) {
+void read_client_msgs(int sock) {
+    struct pollfd fds[1];
     char *line;
     int n;
 
+    fds[0].fd = sock;
+    fds[0].events = POLLIN;
+
     while (1) {
+        // Reply to the scheduled commands while waiting for the next line
+        while ((n = poll(fds, 1, check_scheduled(sock))) == 0)
+            ;
+
+        if (n == -1) {
+            perror("ERROR on poll");
+            break;
+        }
+
         // Read line from the socket
         n = socket_readline(sock, &line);
+
+        // Broken connection (e.g. reset by the client) is closed as well so
+        // it's removed from the fd store
         if (n == -1) {
             perror("ERROR reading from socket");
-            exit(EXIT_FAILURE);
+            break;
         }
 
         // Close connection on empty string
@@ -424,15 +747,332 @@ void read_client_msgs(int sock, struct record *shm_data) {
         } else if (n == 0) {
             if (DEBUG > 0)
                 puts("D: Client closed connection");
+
+            free(line);
             break;
+        } else if (line[0] == 'T') {
+            reply_time(sock, line);
+        } else if (line[0] == '@') {
+            schedule_cmd(sock, line);
         } else {
             if (DEBUG > 1)
                 printf("D: Here is the message: >%s<\n", line);
 
             // Store the line into the shared memory
-            strncpy(shm_data->msg, line, SHM_MSG_SIZE);
-            gettimeofday(&shm_data->time, NULL);
+            route_cmd(line, 0);
+        }
+
+        free(line);
+
+        // The quick ACK mode is not permanent so it must be renewed
+        if (SOCK_QUICKACK)
+            setsockopt(sock, IPPROTO_TCP, TCP_QUICKACK, &SOCK_QUICKACK, sizeof(SOCK_QUICKACK));
+    }
+}
+
+
+// Create the UNIX socket of the local API
+int open_local_api() {
+    struct sockaddr_un addr;
+    int sock, ch;
+
+    // Create the rings in the shared memory
+    if (legoirc_local_create(&LOCAL) == -1) {
+        perror("ERROR on creating local API");
+        exit(EXIT_FAILURE);
+    }
+
+    // The producers route the commands into the rings by themselves
+    LOCAL.shm->channel = CHANNEL;
+
+    for (ch=0; ch<CHANNELS; ch++)
+        LOCAL.shm->served[ch] = channel_transmitter(ch + 1) != NULL;
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        perror("ERROR opening local socket");
+        exit(EXIT_FAILURE);
+    }
+
+    bzero((char *) &addr, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, LOCAL_PATH, sizeof(addr.sun_path) - 1);
+
+    // Remove the socket of the previous run
+    unlink(LOCAL_PATH);
+
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        perror("ERROR on binding local socket");
+        exit(EXIT_FAILURE);
+    }
+
+    // Only the owner and the group can control the vehicle
+    if (chmod(LOCAL_PATH, 0660) == -1) {
+        perror("ERROR on chmod of local socket");
+        exit(EXIT_FAILURE);
+    }
+
+    if (listen(sock, BACKLOG) == -1) {
+        perror("ERROR on listening on local socket");
+        exit(EXIT_FAILURE);
+    }
+
+    return sock;
+}
+
+
+// Pass the rings to the local processes (runs in its own process, the
+// commands are read from the rings by the transmitters themselves)
+void run_local_api(int sock) {
+    int new_sock;
+
+    if (DEBUG > 0)
+        printf("D: Local API is up on %s\n", LOCAL_PATH);
+
+    while (1) {
+        // New local process
+        if ((new_sock = accept(sock, NULL, NULL)) == -1) {
+            perror("ERROR on accept");
+            exit(EXIT_FAILURE);
+        }
+
+        if (legoirc_local_accept(&LOCAL, new_sock) == -1)
+            perror("ERROR on passing local API");
+
+        if (DEBUG > 0)
+            puts("D: New local API process");
+
+        close(new_sock);
+    }
+}
+
+
+// Send the state to the systemd (sd_notify protocol), optionally with the file
+// descriptor for its fd store. Does nothing if not started by the systemd.
+int notify(const char *state, int fd) {
+    char *path = getenv("NOTIFY_SOCKET");
+    char control[CMSG_SPACE(sizeof(int))];
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    int sock, ret;
+
+    if (path == NULL || (path[0] != '/' && path[0] != '@') || strlen(path) >= sizeof(addr.sun_path))
+        return 0;
+
+    bzero((char *) &addr, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    // Socket in the abstract namespace
+    if (path[0] == '@')
+        addr.sun_path[0] = '\0';
+
+    if ((sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1)
+        return -1;
+
+    iov.iov_base = (char *) state;
+    iov.iov_len = strlen(state);
+
+    bzero((char *) &msg, sizeof(msg));
+    msg.msg_name = &addr;
+    msg.msg_namelen = offsetof(struct sockaddr_un, sun_path) + strlen(path);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd >= 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ret = sendmsg(sock, &msg, 0);
+    close(sock);
+
+    return ret == -1 ? -1 : 0;
+}
+
+
+// Take over the sockets passed by the systemd: the listening socket (socket
+// activation) and the client connections from the fd store of the previous
+// run. Returns the listening socket or -1 if there is none.
+int get_listen_fds() {
+    char *pid = getenv("LISTEN_PID");
+    char *fds = getenv("LISTEN_FDS");
+    char *fdnames = getenv("LISTEN_FDNAMES");
+    char *name, *saveptr = NULL;
+    int sock = -1, fd, n, accepting;
+    socklen_t len;
+
+    if (pid == NULL || fds == NULL || atoi(pid) != getpid())
+        return -1;
+
+    n = atoi(fds);
+
+    // The names are in the same order as the file descriptors
+    fdnames = fdnames != NULL ? strdup(fdnames) : NULL;
+    name = fdnames != NULL ? strtok_r(fdnames, ":", &saveptr) : NULL;
+
+    for (fd=LISTEN_FDS_START; fd<LISTEN_FDS_START + n; fd++) {
+        len = sizeof(accepting);
+
+        if (name != NULL && strncmp(name, CLIENT_FDNAME, strlen(CLIENT_FDNAME)) == 0 &&
+                CLIENTS_NUM < MAX_CLIENTS) {
+            CLIENTS[CLIENTS_NUM] = fd;
+            CLIENT_NAMES[CLIENTS_NUM] = strdup(name);
+            CLIENTS_NUM++;
+        } else if (sock == -1 && getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &len) == 0 &&
+                accepting) {
+            sock = fd;
+        } else {
+            close(fd);
         }
+
+        name = name != NULL ? strtok_r(NULL, ":", &saveptr) : NULL;
+    }
+
+    free(fdnames);
+
+    // Not for the child processes
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    return sock;
+}
+
+
+// Close the client connections taken over from the previous run (except the
+// one which is kept)
+void close_clients(int keep) {
+    int i;
+
+    for (i=0; i<CLIENTS_NUM; i++) {
+        if (CLIENTS[i] != -1 && CLIENTS[i] != keep)
+            close(CLIENTS[i]);
+    }
+}
+
+
+// Create the listening socket of the server
+int open_server_socket(int port) {
+    struct sockaddr_in server;
+    struct sockaddr_in6 server6;
+    int yes = 1, no = 0;
+    int sock;
+    int family = SOCK_IPV6 ? AF_INET6 : AF_INET;
+
+    // Create socket
+    if ((sock = socket(family, SOCK_STREAM, 0)) == -1) {
+        perror("ERROR opening socket");
+        exit(EXIT_FAILURE);
+    }
+
+    // Allow to reuse the bind address
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1) {
+        perror("ERROR on setsockopt");
+        exit(EXIT_FAILURE);
+    }
+
+    if (family == AF_INET6) {
+        // Accept also the IPv4 clients (as IPv4-mapped addresses)
+        if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no)) == -1) {
+            perror("ERROR on setsockopt");
+            exit(EXIT_FAILURE);
+        }
+
+        // Initialize socket
+        bzero((char *) &server6, sizeof(server6));
+        server6.sin6_family = AF_INET6;
+        server6.sin6_addr = in6addr_any;
+        server6.sin6_port = htons(port);
+
+        // Bind the host address
+        if (bind(sock, (struct sockaddr *) &server6, sizeof(server6)) == -1) {
+            perror("ERROR on binding");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        // Initialize socket
+        bzero((char *) &server, sizeof(server));
+        server.sin_family = AF_INET;
+        server.sin_addr.s_addr = INADDR_ANY;
+        server.sin_port = htons(port);
+
+        // Bind the host address
+        if (bind(sock, (struct sockaddr *) &server, sizeof(server)) == -1) {
+            perror("ERROR on binding");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Start listening for the clients
+    if (listen(sock, BACKLOG) == -1) {
+        perror("ERROR on listening");
+        exit(EXIT_FAILURE);
+    }
+
+    return sock;
+}
+
+
+// Create child process for the network communication with the client. Unless
+// the connection comes from the fd store of the systemd (name is set), it's
+// put there so it survives the restart of the server.
+void start_client(int sock, int new_sock, int family, char *name) {
+    static int clients_num = 0;
+    char msg[NOTIFY_SIZE];
+    char fdname[64];
+    int pid;
+
+    clients_num++;
+
+    if ((pid = fork()) == -1) {
+        perror("ERROR on fork");
+        exit(EXIT_FAILURE);
+    }
+
+    // This is for the child process only
+    if (pid == 0) {
+        // Child doesn't need the server socket
+        if (close(sock) == -1) {
+            perror("ERROR on close");
+            exit(EXIT_FAILURE);
+        }
+
+        close_clients(new_sock);
+
+        if (name == NULL) {
+            snprintf(fdname, sizeof fdname, "%s%d-%d", CLIENT_FDNAME, getppid(), clients_num);
+            snprintf(msg, sizeof msg, "FDSTORE=1\nFDNAME=%s", fdname);
+            name = fdname;
+
+            if (notify(msg, new_sock) == -1)
+                perror("WARNING on storing connection");
+        }
+
+        // Tune the control connection for low latency
+        set_sock_opts(new_sock, family);
+
+        // Read the message from the client socket
+        read_client_msgs(new_sock);
+
+        // The connection is closed, don't keep it for the next run
+        snprintf(msg, sizeof msg, "FDSTOREREMOVE=1\nFDNAME=%s", name);
+        notify(msg, -1);
+
+        _Exit(EXIT_SUCCESS);
+    }
+
+    // Close the new socket in the parent process
+    if (close(new_sock) == -1) {
+        perror("ERROR on close");
+        exit(EXIT_FAILURE);
     }
 }
 
@@ -450,30 +1090,336 @@ void *get_in_addr(struct sockaddr *sa) {
 }
 
 
+// Parse the transmitter definition in format GPIO:CHANNELS[:MODE] where
+// CHANNELS is a comma separated list of the channels (e.g. "23:1,2:4")
+void add_transmitter(char *arg) {
+    struct transmitter *tx = &TRANSMITTERS[TRANSMITTERS_NUM];
+    char *channels, *mode, *ch;
+    int channel, i;
+
+    if (TRANSMITTERS_NUM >= MAX_TRANSMITTERS) {
+        fprintf(stderr, "ERROR: Max %d transmitters allowed\n", MAX_TRANSMITTERS);
+        exit(EXIT_FAILURE);
+    }
+
+    if ((channels = strchr(arg, ':')) == NULL) {
+        fprintf(stderr, "ERROR: Invalid transmitter definition: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+
+    *channels++ = '\0';
+
+    if ((mode = strchr(channels, ':')) != NULL)
+        *mode++ = '\0';
+
+    tx->pin = atoi(arg);
+    // The default mode is resolved after all options are parsed (see -m)
+    tx->mode = mode ? atoi(mode) : 0;
+
+    for (ch = strtok(channels, ","); ch != NULL; ch = strtok(NULL, ",")) {
+        channel = atoi(ch);
+
+        if (channel < 1 || channel > CHANNELS) {
+            fprintf(stderr, "ERROR: Invalid channel: %s\n", ch);
+            exit(EXIT_FAILURE);
+        }
+
+        // Each channel can be driven only by one transmitter
+        for (i=0; i<TRANSMITTERS_NUM; i++) {
+            if (TRANSMITTERS[i].channels[channel - 1]) {
+                fprintf(stderr, "ERROR: Channel %d is already used by GPIO %d\n",
+                    channel, TRANSMITTERS[i].pin);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        tx->channels[channel - 1] = 1;
+    }
+
+    TRANSMITTERS_NUM++;
+}
+
+
+// Send the command in the IR mode of the transmitter
+void send_cmd(int keycode) {
+    if (MODE == MODE_EXTENDED) {
+        proto_extended_mode(keycode);
+    } else if (MODE == MODE_COMBO_DIRECT) {
+        proto_combo_direct_mode(keycode);
+    } else if (MODE == MODE_SINGLE_OUTPUT) {
+        proto_single_output_mode(keycode);
+    } else if (MODE == MODE_COMBO_PWM) {
+        proto_combo_pwm_mode(keycode);
+    }
+}
+
+
+// Send the commands of the transmitter channels (runs in its own process)
+// Store the newest command from the local API ring of each channel of the
+// transmitter (the transmitter is the only reader of its rings)
+void recv_local(struct transmitter *tx) {
+    struct legoirc_cmd cmd;
+    char msg[2] = {0, 0};
+    int ch;
+
+    if (LOCAL.shm == NULL)
+        return;
+
+    for (ch=0; ch<CHANNELS; ch++) {
+        if (! tx->channels[ch])
+            continue;
+
+        msg[0] = 0;
+
+        while (legoirc_local_recv(&LOCAL, ch + 1, &cmd))
+            msg[0] = cmd.keycode;
+
+        if (msg[0])
+            store_cmd(ch + 1, msg, 0);
+    }
+}
+
+
+// Announce the wait for the local API eventfds. Returns 1 if any of the rings
+// isn't empty (the transmitter shouldn't wait), otherwise 0.
+int sleep_local(struct transmitter *tx) {
+    int ch;
+
+    if (LOCAL.shm == NULL)
+        return 0;
+
+    for (ch=0; ch<CHANNELS; ch++) {
+        if (tx->channels[ch] && legoirc_local_sleep(&LOCAL, ch + 1))
+            return 1;
+    }
+
+    return 0;
+}
+
+
+// Clear the local API eventfds after the wait
+void wake_local(struct transmitter *tx) {
+    int ch;
+
+    if (LOCAL.shm == NULL)
+        return;
+
+    for (ch=0; ch<CHANNELS; ch++) {
+        if (tx->channels[ch])
+            legoirc_local_wake(&LOCAL, ch + 1);
+    }
+}
+
+
+// Wait until the first message of the scheduled command of the channel can be
+// sent at its deadline. Any newer command of the channel (e.g. STOP) replaces
+// the scheduled one and interrupts the wait. Returns 0 when the command should
+// be sent, -1 if it was replaced.
+int wait_scheduled(struct transmitter *tx, int ch, unsigned long long deadline, struct pollfd *fds, int nfds) {
+    long long wait;
+    eventfd_t events;
+
+    while (1) {
+        if (shm_data[ch].deadline != deadline)
+            return -1;
+
+        // The send_msg() waits the CHANNEL_WAIT_1 before the first message
+        wait = (long long) (deadline - now_ns()) / 1000 - (long long) CHANNEL_WAIT_1;
+
+        if (wait <= SCHEDULE_POLL_MIN)
+            break;
+
+        // The poll() isn't precise so it returns before the rest of the wait
+        if (! sleep_local(tx) && poll(fds, nfds, (wait - SCHEDULE_POLL_MIN + 999) / 1000) == -1) {
+            perror("ERROR on poll");
+            exit(EXIT_FAILURE);
+        }
+
+        eventfd_read(tx->wake_fd, &events);
+        wake_local(tx);
+        recv_local(tx);
+    }
+
+    if (wait > 0)
+        bcm2835_delayMicroseconds(wait);
+
+    return 0;
+}
+
+
+void run_transmitter(struct transmitter *tx, int index) {
+    unsigned long long time, deadline, last_time[CHANNELS] = {0}, last_update[CHANNELS] = {0};
+    // The first difference is the whole timestamp in microseconds which
+    // doesn't fit into int
+    long long time_diff = 0;
+    // Keycode of the last command sent on the channel
+    int last_keycode[CHANNELS] = {0};
+    int keycode, idle, ch, nfds = 1;
+    struct pollfd fds[1 + CHANNELS];
+    eventfd_t events;
+    cpu_set_t cpus;
+    long cpus_num = sysconf(_SC_NPROCESSORS_ONLN);
+    int cpu = 0;
+
+    // Pin the worker to its own core (the first core is left for the network
+    // communication, the transmitters share the other ones if there are more
+    // transmitters than cores)
+    if (cpus_num > 1) {
+        cpu = 1 + index % (cpus_num - 1);
+
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
+            perror("WARNING on sched_setaffinity");
+    }
+
+    // The globals are private to the worker process
+    GPIO_PIN = tx->pin;
+    MODE = tx->mode;
+    TX = tx;
+
+    fds[0].fd = tx->wake_fd;
+    fds[0].events = POLLIN;
+
+    // Commands of the local API wake the transmitter up through the eventfds
+    // of its channels
+    for (ch=0; ch<CHANNELS && LOCAL.shm != NULL; ch++) {
+        if (tx->channels[ch]) {
+            fds[nfds].fd = LOCAL.event_fds[ch];
+            fds[nfds].events = POLLIN;
+            nfds++;
+        }
+    }
+
+    if (DEBUG > 0)
+        printf("D: Transmitter on GPIO %d (mode %d, CPU %d) is up\n", GPIO_PIN, MODE, cpu);
+
+    while (1) {
+        idle = 1;
+
+        recv_local(tx);
+
+        for (ch=0; ch<CHANNELS; ch++) {
+            if (! tx->channels[ch])
+                continue;
+
+            // Command is only the first character
+            keycode = shm_data[ch].msg[0];
+
+            time = (unsigned long long) (shm_data[ch].time.tv_sec * 1e6 + shm_data[ch].time.tv_usec);
+            time_diff = time - last_update[ch];
+            deadline = shm_data[ch].deadline;
+
+            // Scheduled command (see schedule_cmd()) is sent regardless of the
+            // limit so its first message starts at the deadline
+            if (deadline != 0 && deadline != shm_data[ch].done && deadline < now_ns() + SCHEDULE_TIMEOUT) {
+                // Timing of the message depends on the channel
+                CHANNEL = ch + 1;
+                init();
+
+                idle = 0;
+
+                // Replaced by a newer command which is handled in the next
+                // round
+                if (wait_scheduled(tx, ch, deadline, fds, nfds) == -1)
+                    continue;
+
+                // The first message can't start at the deadline any more (e.g.
+                // the deadline was already in the past), the client is told
+                // that the command wasn't sent
+                if (now_ns() + (unsigned long long) CHANNEL_WAIT_1 * 1000 > deadline + SCHEDULE_LATE) {
+                    if (DEBUG > 0)
+                        printf("D: Scheduled command for the channel %d missed the deadline\n", ch + 1);
+
+                    shm_data[ch].sent = 0;
+                    __atomic_store_n(&shm_data[ch].done, deadline, __ATOMIC_RELEASE);
+
+                    // Don't send it as an ordinary command either
+                    last_keycode[ch] = keycode;
+                    last_update[ch] = time;
+                    last_time[ch] = time;
+
+                    continue;
+                }
+
+                SENDING[ch] = deadline;
+                send_cmd(keycode);
+                SENDING[ch] = 0;
+
+                last_keycode[ch] = keycode;
+                last_update[ch] = time;
+                last_time[ch] = time;
+
+                continue;
+            }
+
+            // Limit the number of messages of the same command but send a
+            // different command (e.g. STOP or a turn) at any time
+            if (time_diff > CMD_LOOP_WAIT || keycode != last_keycode[ch]) {
+                // Timing of the message depends on the channel
+                CHANNEL = ch + 1;
+                init();
+
+                send_cmd(keycode);
+
+                last_keycode[ch] = keycode;
+                last_update[ch] = time;
+                idle = 0;
+            } else if (time_diff != 0 && time != last_time[ch]) {
+                idle = 0;
+            }
+
+            last_time[ch] = time;
+        }
+
+        // Waiting a bit to not to overload the CPU (a new command wakes the
+        // transmitter up immediately)
+        if (idle && ! sleep_local(tx) && poll(fds, nfds, CMD_LOOP_WAIT / 1000) == -1) {
+            perror("ERROR on poll");
+            exit(EXIT_FAILURE);
+        }
+
+        // Clear the wake ups of the commands which are going to be sent
+        eventfd_read(tx->wake_fd, &events);
+        wake_local(tx);
+    }
+}
+
+
 void usage(char *name) {
     printf("Usage: %s [options]\n\n", name);
     puts("Options:");
     puts(" -p NUM  Server port number (default: 5001)");
-    puts(" -c NUM  IR channel (default: 1)");
+    puts(" -c NUM  IR channel of the commands without the channel prefix (default: 1)");
     puts(" -m NUM  IR mode");
     puts("           1 = Extended mode");
     puts("           2 = Combo direct mode");
     puts("           3 = Single output mode");
     puts("           4 = Combo PWM mode (default)");
     puts(" -g NUM  GPIO (default: 24)");
+    puts(" -x STR  Transmitter in format GPIO:CHANNELS[:MODE] (e.g. 23:1,2:4),");
+    puts("         can be used multiple times (default: GPIO:CHANNEL:MODE)");
+    puts(" -L STR  UNIX socket of the local command API (default: disabled)");
+    puts(" -6      Listen on IPv6 and IPv4 (dual-stack)");
+    puts(" -n      Don't disable the Nagle's algorithm (TCP_NODELAY)");
+    puts(" -k      Don't use the quick ACK mode (TCP_QUICKACK)");
+    puts(" -P NUM  Socket priority, 0 to disable (default: 6)");
+    puts(" -T NUM  DSCP value of the control traffic, 0 to disable (default: 46)");
+    puts(" -B NUM  Busy poll timeout in microseconds, 0 to disable (default: 0)");
     puts(" -d NUM  Debug level [0-3] (default: 0)");
     puts(" -h      Show this help message and exit");
 }
 
 
 int main(int argc, char *argv[]) {
-    struct sockaddr_in server, client;
+    struct sockaddr_storage client, addr;
     char ip[INET6_ADDRSTRLEN];
-    unsigned int client_len = sizeof(client);
-    int yes = 1;
+    unsigned int client_len;
+    socklen_t addr_len;
+    int family;
     int port = 5001;
-    int sock, new_sock, pid, c;
-    struct record *shm_data;
+    int sock, local_sock, new_sock, pid, c, i;
 
     // Silently reap children
     signal(SIGCHLD, SIG_IGN);
@@ -486,7 +1432,7 @@ int main(int argc, char *argv[]) {
     init();
 
     // Parse command line options
-    while ((c = getopt(argc, argv, "g:d:c:m:p:h")) != -1) {
+    while ((c = getopt(argc, argv, "g:d:c:m:p:x:L:6nkP:T:B:h")) != -1) {
         switch (c) {
             case 'h':
                 usage(argv[0]);
@@ -505,6 +1451,30 @@ int main(int argc, char *argv[]) {
             case 'g':
                 GPIO_PIN = atoi(optarg);
                 break;
+            case 'x':
+                add_transmitter(optarg);
+                break;
+            case 'L':
+                LOCAL_PATH = optarg;
+                break;
+            case '6':
+                SOCK_IPV6 = 1;
+                break;
+            case 'n':
+                SOCK_NODELAY = 0;
+                break;
+            case 'k':
+                SOCK_QUICKACK = 0;
+                break;
+            case 'P':
+                SOCK_PRIORITY = atoi(optarg);
+                break;
+            case 'T':
+                SOCK_DSCP = atoi(optarg);
+                break;
+            case 'B':
+                SOCK_BUSY_POLL = atoi(optarg);
+                break;
             case 'd':
                 DEBUG = atoi(optarg);
                 break;
@@ -513,56 +1483,86 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (CHANNEL < 1 || CHANNEL > CHANNELS) {
+        fprintf(stderr, "ERROR: Invalid channel: %d\n", CHANNEL);
+        exit(EXIT_FAILURE);
+    }
+
+    // Transmitters without the mode use the one given by the -m option
+    for (i=0; i<TRANSMITTERS_NUM; i++) {
+        if (TRANSMITTERS[i].mode == 0)
+            TRANSMITTERS[i].mode = MODE;
+    }
+
+    // Single transmitter defined by the -g, -c and -m options
+    if (TRANSMITTERS_NUM == 0) {
+        TRANSMITTERS[0].pin = GPIO_PIN;
+        TRANSMITTERS[0].channels[CHANNEL - 1] = 1;
+        TRANSMITTERS[0].mode = MODE;
+        TRANSMITTERS_NUM = 1;
+    }
+
+    // Each transmitter should have its own core (the first one is left for
+    // the network communication)
+    if (sysconf(_SC_NPROCESSORS_ONLN) > 1 && TRANSMITTERS_NUM > sysconf(_SC_NPROCESSORS_ONLN) - 1)
+        fprintf(stderr, "WARNING: %d transmitters share %ld free CPU cores\n", TRANSMITTERS_NUM,
+            sysconf(_SC_NPROCESSORS_ONLN) - 1);
+
+    // Commands without the channel prefix are sent to the default channel
+    if (channel_transmitter(CHANNEL) == NULL) {
+        fprintf(stderr, "ERROR: Default channel %d is not served by any transmitter\n", CHANNEL);
+        exit(EXIT_FAILURE);
+    }
+
     // Print some information
     if (DEBUG > 0) {
         printf("D: Server port number: %d\n", port);
-        printf("D: GPIO: %d\n", GPIO_PIN);
         printf("D: IR channel: %d\n", CHANNEL);
-        printf("D: IR mode: %d\n", MODE);
+
+        for (i=0; i<TRANSMITTERS_NUM; i++) {
+            printf("D: Transmitter %d: GPIO=%d mode=%d channels=", i + 1,
+                TRANSMITTERS[i].pin, TRANSMITTERS[i].mode);
+
+            for (c=0; c<CHANNELS; c++) {
+                if (TRANSMITTERS[i].channels[c])
+                    printf("%d ", c + 1);
+            }
+
+            printf("\n");
+        }
+
+        printf("D: Socket: ipv6=%d nodelay=%d quickack=%d priority=%d dscp=%d busy_poll=%d\n",
+            SOCK_IPV6, SOCK_NODELAY, SOCK_QUICKACK, SOCK_PRIORITY, SOCK_DSCP, SOCK_BUSY_POLL);
     }
 
     // Initiate the bus
     if (! bcm2835_init())
         return 1;
 
-    // Set the output pin
-    bcm2835_gpio_fsel(GPIO_PIN, BCM2835_GPIO_FSEL_OUTP);
-
-    // Create socket
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        perror("ERROR opening socket");
-        exit(EXIT_FAILURE);
-    }
-
-    // Initialize socket
-    bzero((char *) &server, sizeof(server));
-    server.sin_family = AF_INET;
-    server.sin_addr.s_addr = INADDR_ANY;
-    server.sin_port = htons(port);
+    // Set the output pins
+    for (i=0; i<TRANSMITTERS_NUM; i++)
+        bcm2835_gpio_fsel(TRANSMITTERS[i].pin, BCM2835_GPIO_FSEL_OUTP);
 
-    // Allow to reuse the bind address
-    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1) {
-        perror("ERROR on setsockopt");
-        exit(EXIT_FAILURE);
+    // Socket passed by the systemd or our own
+    if ((sock = get_listen_fds()) == -1) {
+        sock = open_server_socket(port);
+    } else if (DEBUG > 0) {
+        printf("D: Using socket passed by systemd (%d client connections)\n", CLIENTS_NUM);
     }
 
-    // Bind the host address
-    if (bind(sock, (struct sockaddr *) &server, sizeof(server)) == -1) {
-        perror("ERROR on binding");
+    addr_len = sizeof(addr);
+    if (getsockname(sock, (struct sockaddr *) &addr, &addr_len) == -1) {
+        perror("ERROR on getsockname");
         exit(EXIT_FAILURE);
     }
 
-    // Start listening for the clients
-    if (listen(sock, BACKLOG) == -1) {
-        perror("ERROR on listening");
-        exit(EXIT_FAILURE);
-    }
+    family = addr.ss_family;
 
     if (DEBUG > 0)
         puts("D: Server is up");
 
-    // Create the shared memory segment
-    if ((shm_id = shmget(IPC_PRIVATE, sizeof(shm_data), 0600 | IPC_CREAT)) == -1) {
+    // Create the shared memory segment (one record per channel)
+    if ((shm_id = shmget(IPC_PRIVATE, CHANNELS * sizeof(struct record), 0600 | IPC_CREAT)) == -1) {
         perror("ERROR on shmget");
         exit(EXIT_FAILURE);
     }
@@ -574,71 +1574,37 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    // Create child process for the IR communication
-    if ((pid = fork()) == -1) {
-        perror("ERROR on fork");
-        exit(EXIT_FAILURE);
-    }
-
-    // This is for the child process only
-    if (pid == 0) {
-        unsigned long long time, last_time = 0, last_update = 0;
-        int time_diff = 0;
-        int stop_sent = 0;
-        int keycode;
+    // Create child process for the local API (before the transmitters so
+    // they inherit the rings)
+    if (LOCAL_PATH != NULL) {
+        local_sock = open_local_api();
 
-        while (1) {
-            // Command is only the first character
-            keycode = shm_data->msg[0];
-
-            time = (unsigned long long) (shm_data->time.tv_sec * 1e6 + shm_data->time.tv_usec);
-            time_diff = time - last_update;
-
-            // Limit the number of messages but send STOP at any time only once
-            if (time_diff > CMD_LOOP_WAIT || (keycode == KEYCODE_STOP && stop_sent == 0)) {
-                // Use specific mode
-                if (MODE == MODE_EXTENDED) {
-                    proto_extended_mode(keycode);
-                } else if (MODE == MODE_COMBO_DIRECT) {
-                    proto_combo_direct_mode(keycode);
-                } else if (MODE == MODE_SINGLE_OUTPUT) {
-                    proto_single_output_mode(keycode);
-                } else if (MODE == MODE_COMBO_PWM) {
-                    proto_combo_pwm_mode(keycode);
-                }
+        if ((pid = fork()) == -1) {
+            perror("ERROR on fork");
+            exit(EXIT_FAILURE);
+        }
 
-                // Make sure we send STOP only once
-                if (keycode == KEYCODE_STOP) {
-                    stop_sent = 1;
-                } else {
-                    stop_sent = 0;
-                }
+        // This is for the child process only
+        if (pid == 0) {
+            close(sock);
+            close_clients(-1);
 
-                last_update = time;
-            } else if (time_diff == 0 || time == last_time) {
-                // Waiting a bit to not to overload the CPU
-                bcm2835_delayMicroseconds(CMD_LOOP_WAIT);
-            }
+            run_local_api(local_sock);
 
-            last_time = time;
+            _Exit(EXIT_SUCCESS);
         }
 
-        _Exit(EXIT_SUCCESS);
+        close(local_sock);
     }
 
-    while (1) {
-        // Accept connections from clients
-        if ((new_sock = accept(sock, (struct sockaddr *) &client, &client_len)) == -1) {
-            perror("ERROR on accept");
+    // Create child process for each IR transmitter (the first core is left
+    // for the network communication)
+    for (i=0; i<TRANSMITTERS_NUM; i++) {
+        if ((TRANSMITTERS[i].wake_fd = eventfd(0, EFD_NONBLOCK)) == -1) {
+            perror("ERROR on eventfd");
             exit(EXIT_FAILURE);
         }
 
-        // Get IP of the client
-        inet_ntop(client.sin_family, get_in_addr((struct sockaddr *) &client), ip, sizeof ip);
-        if (DEBUG > 0)
-            printf("D: New connection from %s\n", ip);
-
-        // Create child process for the network communication
         if ((pid = fork()) == -1) {
             perror("ERROR on fork");
             exit(EXIT_FAILURE);
@@ -646,23 +1612,43 @@ int main(int argc, char *argv[]) {
 
         // This is for the child process only
         if (pid == 0) {
-            // Child doesn't need the server socket
-            if (close(sock) == -1) {
-                perror("ERROR on close");
-                exit(EXIT_FAILURE);
-            }
+            // The transmitter doesn't need the sockets
+            close(sock);
+            close_clients(-1);
 
-            // Read the message from the client socket
-            read_client_msgs(new_sock, shm_data);
+            run_transmitter(&TRANSMITTERS[i], i);
 
             _Exit(EXIT_SUCCESS);
         }
+    }
 
-        // Close the new socket in the parent process
-        if (close(new_sock) == -1) {
-            perror("ERROR on close");
+    // Continue with the clients of the previous run
+    for (i=0; i<CLIENTS_NUM; i++) {
+        if (DEBUG > 0)
+            printf("D: Taking over connection %s\n", CLIENT_NAMES[i]);
+
+        start_client(sock, CLIENTS[i], family, CLIENT_NAMES[i]);
+        CLIENTS[i] = -1;
+        free(CLIENT_NAMES[i]);
+    }
+
+    // Tell the systemd that the server is ready
+    notify("READY=1", -1);
+
+    while (1) {
+        // Accept connections from clients
+        client_len = sizeof(client);
+        if ((new_sock = accept(sock, (struct sockaddr *) &client, &client_len)) == -1) {
+            perror("ERROR on accept");
             exit(EXIT_FAILURE);
         }
+
+        // Get IP of the client
+        inet_ntop(client.ss_family, get_in_addr((struct sockaddr *) &client), ip, sizeof ip);
+        if (DEBUG > 0)
+            printf("D: New connection from %s\n", ip);
+
+        start_client(sock, new_sock, family, NULL);
     }
 
     // Clear the bus settings
@@ -0,0 +1,269 @@
+#include <string.h>
+
+#include "pfdecode.h"
+
+
+// Decoder states
+#define STATE_IDLE 0
+#define STATE_START 1
+#define STATE_DATA 2
+#define STATE_STOP 3
+#define STATE_STOP_SPACE 4
+
+// Initial value of the margins
+#define MARGIN_NONE 1e9
+
+
+static float margin(float value, float min, float max) {
+    return (value - min < max - value) ? value - min : max - value;
+}
+
+
+static float min_margin(float a, float b) {
+    return a < b ? a : b;
+}
+
+
+// Required time between the start of the repetition and the previous one
+static float repeat_slot(int repeat, int channel) {
+    if (repeat <= 3) {
+        return 5 * PF_MAX_MSG_LEN;
+    } else {
+        return (6 + 2 * channel) * PF_MAX_MSG_LEN;
+    }
+}
+
+
+static void reset_frame(struct pf_decoder *d, unsigned long long time) {
+    memset(&d->frame, 0, sizeof d->frame);
+
+    d->frame.pin = d->pin;
+    d->frame.start = time;
+    d->frame.mark_margin = MARGIN_NONE;
+    d->frame.bit_margin = MARGIN_NONE;
+
+    d->bits = 0;
+}
+
+
+static void add_bit(struct pf_decoder *d, float len, float min, float max, float nominal) {
+    d->frame.bit_margin = min_margin(d->frame.bit_margin, margin(len, min, max));
+    d->frame.dev_sum += len - nominal;
+    d->frame.dev_sq_sum += (len - nominal) * (len - nominal);
+    d->frame.bits++;
+}
+
+
+static void lose_frame(struct pf_decoder *d) {
+    d->lost = 1;
+    d->lost_start = d->frame.start;
+}
+
+
+// Check the checksum and the timing of the repetitions of the complete frame
+static void finish_frame(struct pf_decoder *d) {
+    struct pf_frame *f = &d->frame;
+    struct pf_frame *last = &d->last;
+    float slot, gap;
+
+    if ((0xf ^ f->nibble[0] ^ f->nibble[1] ^ f->nibble[2]) != f->nibble[3]) {
+        f->status = PF_ERR_LRC;
+        lose_frame(d);
+        return;
+    }
+
+    f->channel = (f->nibble[0] & 3) + 1;
+    f->repeat = 1;
+
+    // Distance from the previous frame (also a broken one)
+    gap = f->start - (d->lost ? d->lost_start : last->start);
+
+    // The same message after a gap longer than the longest repetition slot
+    // starts a new sequence
+    if (last->status == PF_OK && memcmp(last->nibble, f->nibble, sizeof f->nibble) == 0 &&
+            gap < repeat_slot(PF_REPEAT, f->channel) + PF_MAX_MSG_LEN) {
+        slot = repeat_slot(last->repeat + 1, f->channel);
+
+        if (d->lost || last->repeat == 0) {
+            // Some repetition of the message was lost so the position of the
+            // following ones is unknown until the sequence ends
+            f->repeat = 0;
+        } else if (last->repeat < PF_REPEAT) {
+            if (gap < slot + PF_MAX_MSG_LEN) {
+                f->repeat = last->repeat + 1;
+                f->gap_margin = gap - slot;
+            } else {
+                // Doesn't fit into the expected slot
+                f->repeat = 0;
+            }
+        }
+    }
+
+    d->lost = 0;
+
+    memcpy(last, f, sizeof *last);
+
+    // The repetition came before its slot (it's still kept as the last one
+    // so the following repetitions are checked against it)
+    if (f->repeat > 1 && f->gap_margin < 0)
+        f->status = PF_ERR_GAP;
+}
+
+
+void pf_decoder_init(struct pf_decoder *d, int pin) {
+    memset(d, 0, sizeof *d);
+
+    d->pin = pin;
+    d->state = STATE_IDLE;
+}
+
+
+int pf_decoder_edge(struct pf_decoder *d, unsigned long long time, int level, struct pf_frame *frame) {
+    float len;
+    int ret = 0;
+
+    if (level) {
+        len = time - d->last_rise;
+        d->last_rise = time;
+
+        if (d->state == STATE_STOP_SPACE) {
+            // The pause after the stop pulse must be at least as long as the
+            // one of the start bit
+            d->frame.bit_margin = min_margin(d->frame.bit_margin, len - PF_START_BIT_MIN);
+
+            if (len >= PF_START_BIT_MIN) {
+                finish_frame(d);
+            } else {
+                d->frame.status = PF_ERR_BIT;
+                lose_frame(d);
+            }
+
+            memcpy(frame, &d->frame, sizeof *frame);
+            ret = 1;
+
+            // The current pulse can be the start of the next frame
+            d->state = STATE_IDLE;
+        }
+
+        if (d->state == STATE_IDLE) {
+            reset_frame(d, time);
+            d->state = STATE_START;
+        } else if (d->state == STATE_START) {
+            if (len >= PF_START_BIT_MIN && len < PF_START_BIT_MAX) {
+                add_bit(d, len, PF_START_BIT_MIN, PF_START_BIT_MAX, PF_START_BIT_LEN);
+                d->state = STATE_DATA;
+            } else {
+                // Pulses without a valid start bit are a lost frame
+                if (len < PF_START_BIT_MIN)
+                    lose_frame(d);
+
+                // Not a start bit, try the current pulse
+                reset_frame(d, time);
+            }
+        } else if (d->state == STATE_DATA) {
+            if (len >= PF_LOW_BIT_MIN && len < PF_LOW_BIT_MAX) {
+                add_bit(d, len, PF_LOW_BIT_MIN, PF_LOW_BIT_MAX, PF_LOW_BIT_LEN);
+                d->frame.nibble[d->bits / 4] <<= 1;
+                d->bits++;
+            } else if (len >= PF_HIGH_BIT_MIN && len < PF_HIGH_BIT_MAX) {
+                add_bit(d, len, PF_HIGH_BIT_MIN, PF_HIGH_BIT_MAX, PF_HIGH_BIT_LEN);
+                d->frame.nibble[d->bits / 4] = (d->frame.nibble[d->bits / 4] << 1) | 1;
+                d->bits++;
+            } else {
+                if (len > PF_MAX_MSG_LEN) {
+                    // The signal went idle in the middle of the frame
+                    d->frame.status = PF_ERR_TRUNCATED;
+                } else {
+                    d->frame.status = PF_ERR_BIT;
+                    d->frame.bit_margin = min_margin(d->frame.bit_margin,
+                        len < PF_LOW_BIT_MIN ? len - PF_LOW_BIT_MIN : PF_HIGH_BIT_MAX - len);
+                }
+
+                memcpy(frame, &d->frame, sizeof *frame);
+                lose_frame(d);
+                ret = 1;
+
+                // The current pulse can be the start of the next frame
+                reset_frame(d, time);
+                d->state = STATE_START;
+
+                return ret;
+            }
+
+            // The pulse after the 16 bits is the stop bit
+            if (d->bits == 16) {
+                d->frame.stop = time;
+                d->state = STATE_STOP;
+            }
+        }
+    } else {
+        len = time - d->last_rise;
+        d->last_fall = time;
+
+        if (d->state == STATE_IDLE)
+            return ret;
+
+        d->frame.mark_margin = min_margin(d->frame.mark_margin, margin(len, PF_MARK_MIN, PF_MARK_MAX));
+
+        if (len < PF_MARK_MIN || len > PF_MARK_MAX) {
+            // Broken pulse before the start bit is just a noise
+            if (d->state != STATE_START) {
+                d->frame.status = PF_ERR_MARK;
+                memcpy(frame, &d->frame, sizeof *frame);
+                lose_frame(d);
+                ret = 1;
+            }
+
+            d->state = STATE_IDLE;
+        } else if (d->state == STATE_STOP) {
+            // The frame is finished after the stop bit pause
+            d->state = STATE_STOP_SPACE;
+        }
+    }
+
+    return ret;
+}
+
+
+int pf_decoder_flush(struct pf_decoder *d, struct pf_frame *frame) {
+    // The signal went idle after the stop bit
+    if (d->state == STATE_STOP_SPACE) {
+        finish_frame(d);
+        memcpy(frame, &d->frame, sizeof *frame);
+
+        d->state = STATE_IDLE;
+
+        return 1;
+    }
+
+    if (d->state != STATE_DATA && d->state != STATE_STOP)
+        return 0;
+
+    d->frame.status = PF_ERR_TRUNCATED;
+    memcpy(frame, &d->frame, sizeof *frame);
+    lose_frame(d);
+
+    d->state = STATE_IDLE;
+
+    return 1;
+}
+
+
+const char *pf_status_str(int status) {
+    switch (status) {
+        case PF_OK:
+            return "OK";
+        case PF_ERR_MARK:
+            return "pulse length";
+        case PF_ERR_BIT:
+            return "bit length";
+        case PF_ERR_LRC:
+            return "checksum";
+        case PF_ERR_TRUNCATED:
+            return "truncated";
+        case PF_ERR_GAP:
+            return "repeat timing";
+        default:
+            return "unknown";
+    }
+}
@@ -0,0 +1,101 @@
+// Decoder of the LEGO Power Functions IR messages
+// (http://powerfunctions.lego.com/en-GB/ElementSpecs/8884.aspx)
+//
+// The decoder is fed by the edges of the IR LED signal (as recorded by the
+// simulated GPIO backend or captured by a logic analyzer) and produces the
+// decoded frames together with the timing margins of each frame.
+
+#ifndef PFDECODE_H
+#define PFDECODE_H
+
+
+// IR carrier period (in microseconds)
+#define PF_CYCLE (1e3 / 38)
+
+// Max message length (in microseconds)
+#define PF_MAX_MSG_LEN 16000
+
+// Accepted length of the LED pulse (the spec sends 6 IR cycles)
+#define PF_MARK_MIN (4 * PF_CYCLE)
+#define PF_MARK_MAX (10 * PF_CYCLE)
+
+// Accepted bit lengths measured from pulse to pulse (from the spec)
+#define PF_LOW_BIT_MIN 316
+#define PF_LOW_BIT_MAX 526
+#define PF_HIGH_BIT_MIN 526
+#define PF_HIGH_BIT_MAX 947
+#define PF_START_BIT_MIN 947
+#define PF_START_BIT_MAX 1579
+
+// Nominal bit lengths (6 cycles pulse + 10, 21 or 39 cycles pause)
+#define PF_LOW_BIT_LEN (16 * PF_CYCLE)
+#define PF_HIGH_BIT_LEN (27 * PF_CYCLE)
+#define PF_START_BIT_LEN (45 * PF_CYCLE)
+
+// Number of repetitions of each message
+#define PF_REPEAT 5
+
+// Frame status
+#define PF_OK 0
+#define PF_ERR_MARK 1
+#define PF_ERR_BIT 2
+#define PF_ERR_LRC 3
+#define PF_ERR_TRUNCATED 4
+#define PF_ERR_GAP 5
+#define PF_ERR_COUNT 6
+
+
+// Decoded frame
+struct pf_frame {
+    int pin;
+    int status;
+    // Time of the rising edge of the start and the stop bit
+    unsigned long long start, stop;
+    // Nibbles of the message (the last one is the checksum)
+    int nibble[4];
+    // Channel (1-4) and repetition (1-5, 0 if unknown because some of the
+    // previous repetitions was lost) of the message
+    int channel;
+    int repeat;
+    // The smallest distance of any pulse and bit from its tolerance limits
+    float mark_margin;
+    float bit_margin;
+    // Distance from the required start to start time of the repetitions
+    // (only for the repeat > 1, negative value means the repetition came
+    // too early)
+    float gap_margin;
+    // Sum and sum of squares of the bit length deviations from the nominal
+    float dev_sum, dev_sq_sum;
+    int bits;
+};
+
+// Decoder state of a single pin
+struct pf_decoder {
+    int pin;
+    int state;
+    int bits;
+    // Some frame was broken since the last accepted one
+    int lost;
+    // Start time of the last broken frame
+    unsigned long long lost_start;
+    unsigned long long last_rise, last_fall;
+    struct pf_frame frame;
+    // The last accepted frame (to check the repetitions)
+    struct pf_frame last;
+};
+
+
+void pf_decoder_init(struct pf_decoder *d, int pin);
+
+// Feed the decoder by a single edge. Returns 1 if a frame was completed (also
+// a broken one) and stored into the frame argument, otherwise 0. A frame is
+// completed only by the next rising edge which validates the stop bit pause.
+int pf_decoder_edge(struct pf_decoder *d, unsigned long long time, int level, struct pf_frame *frame);
+
+// Get the unfinished frame at the end of the trace. Returns 1 if there was any.
+int pf_decoder_flush(struct pf_decoder *d, struct pf_frame *frame);
+
+// Text description of the frame status
+const char *pf_status_str(int status);
+
+#endif